@@ -0,0 +1,57 @@
+#include "chunkcache.hpp"
+
+#include <algorithm>
+
+using namespace rlib;
+
+ChunkCache::ChunkCache(std::size_t max_size, std::uint32_t shards)
+    : max_size_(max_size), shard_max_size_(max_size / std::max(shards, 1u)), shards_(std::max(shards, 1u)) {}
+
+auto ChunkCache::shard(ChunkID chunkId) noexcept -> Shard& {
+    // chunk ids are hashes already, top bits are as good as any
+    return shards_[((std::uint64_t)chunkId >> 32) % shards_.size()];
+}
+
+auto ChunkCache::get(ChunkID chunkId) -> Data {
+    if (!max_size_) {
+        ++misses_;
+        return {};
+    }
+    auto& shard = this->shard(chunkId);
+    std::lock_guard lock(shard.mutex);
+    auto i = shard.map.find(chunkId);
+    if (i == shard.map.end()) {
+        ++misses_;
+        return {};
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, i->second);
+    ++hits_;
+    return i->second->second;
+}
+
+auto ChunkCache::contains(ChunkID chunkId) -> bool {
+    auto& shard = this->shard(chunkId);
+    std::lock_guard lock(shard.mutex);
+    return shard.map.contains(chunkId);
+}
+
+auto ChunkCache::put(ChunkID chunkId, Data data) -> void {
+    if (!data || data->size() > shard_max_size_) {
+        return;
+    }
+    auto& shard = this->shard(chunkId);
+    std::lock_guard lock(shard.mutex);
+    if (auto i = shard.map.find(chunkId); i != shard.map.end()) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, i->second);
+        return;
+    }
+    shard.size += data->size();
+    shard.lru.emplace_front(chunkId, std::move(data));
+    shard.map.emplace(chunkId, shard.lru.begin());
+    while (shard.size > shard_max_size_) {
+        auto& [old_id, old_data] = shard.lru.back();
+        shard.size -= old_data->size();
+        shard.map.erase(old_id);
+        shard.lru.pop_back();
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "buffer.hpp"
+#include "rchunk.hpp"
+
+namespace rlib {
+    // Size bounded LRU of decompressed chunks shared between threads.
+    // Split into shards with their own lock so concurrent readers rarely contend.
+    struct ChunkCache {
+        using Data = std::shared_ptr<Buffer const>;
+
+        ChunkCache(std::size_t max_size, std::uint32_t shards = 16);
+        ChunkCache(ChunkCache const&) = delete;
+
+        auto get(ChunkID chunkId) -> Data;
+
+        auto put(ChunkID chunkId, Data data) -> void;
+
+        // Does not count as hit or miss and does not refresh entry.
+        auto contains(ChunkID chunkId) -> bool;
+
+        auto max_size() const noexcept -> std::size_t { return max_size_; }
+
+        // Bigger chunks do not fit into their shard and are never kept.
+        auto max_chunk_size() const noexcept -> std::size_t { return shard_max_size_; }
+
+        auto hits() const noexcept -> std::uint64_t { return hits_; }
+
+        auto misses() const noexcept -> std::uint64_t { return misses_; }
+
+    private:
+        struct Shard {
+            std::mutex mutex;
+            std::list<std::pair<ChunkID, Data>> lru;
+            std::unordered_map<ChunkID, std::list<std::pair<ChunkID, Data>>::iterator> map;
+            std::size_t size = {};
+        };
+        std::size_t max_size_ = {};
+        std::size_t shard_max_size_ = {};
+        std::vector<Shard> shards_;
+        std::atomic<std::uint64_t> hits_ = {};
+        std::atomic<std::uint64_t> misses_ = {};
+
+        auto shard(ChunkID chunkId) noexcept -> Shard&;
+    };
+}
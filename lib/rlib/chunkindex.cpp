@@ -0,0 +1,123 @@
+#include "chunkindex.hpp"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#    include <emmintrin.h>
+#    define RLIB_CHUNKINDEX_SSE2 1
+#endif
+
+using namespace rlib;
+
+static constexpr std::size_t MIN_TAIL = 4096;
+
+static auto bucket_bits(std::size_t count) noexcept -> int { return std::min((int)std::bit_width(count >> 2), 32); }
+
+static auto bucket_of(ChunkID chunkId, int bits) noexcept -> std::size_t {
+    return bits ? (std::size_t)((std::uint64_t)chunkId >> (64 - bits)) : 0;
+}
+
+ChunkIndex::ChunkIndex(std::vector<std::pair<ChunkID, Entry>> chunks) { this->merge(std::move(chunks)); }
+
+auto ChunkIndex::find(ChunkID chunkId) const noexcept -> Entry const* {
+    if (auto i = probe(buckets_, ids_, chunkId); i != npos) {
+        return &entries_[i];
+    }
+    if (auto i = tail_.find(chunkId); i != tail_.end()) {
+        return &i->second;
+    }
+    return nullptr;
+}
+
+auto ChunkIndex::insert(ChunkID chunkId, Entry const& entry) -> bool {
+    if (this->find(chunkId)) {
+        return false;
+    }
+    tail_.emplace(chunkId, entry);
+    // growing tail with size keeps amortized cost of folding it constant
+    if (tail_.size() > std::max(MIN_TAIL, ids_.size() / 8)) {
+        this->compact();
+    }
+    return true;
+}
+
+auto ChunkIndex::merge(std::vector<std::pair<ChunkID, Entry>> chunks) -> void {
+    std::stable_sort(chunks.begin(), chunks.end(), [](auto const& l, auto const& r) { return l.first < r.first; });
+    chunks.erase(uniq_by<&std::pair<ChunkID, Entry>::first>(chunks.begin(), chunks.end()), chunks.end());
+    rlib_assert(ids_.size() + chunks.size() <= UINT32_MAX);
+    auto ids = std::vector<ChunkID>{};
+    auto entries = std::vector<Entry>{};
+    ids.reserve(ids_.size() + chunks.size());
+    entries.reserve(ids_.size() + chunks.size());
+    auto i = std::size_t{0};
+    auto j = chunks.begin();
+    while (i != ids_.size() || j != chunks.end()) {
+        if (j == chunks.end() || (i != ids_.size() && ids_[i] <= j->first)) {
+            if (j != chunks.end() && ids_[i] == j->first) {
+                ++j;
+            }
+            ids.push_back(ids_[i]);
+            entries.push_back(entries_[i]);
+            ++i;
+        } else {
+            ids.push_back(j->first);
+            entries.push_back(j->second);
+            ++j;
+        }
+    }
+    ids_ = std::move(ids);
+    entries_ = std::move(entries);
+    buckets_ = make_buckets(ids_);
+}
+
+auto ChunkIndex::compact() -> void {
+    if (tail_.empty()) {
+        return;
+    }
+    auto chunks = std::vector<std::pair<ChunkID, Entry>>(tail_.begin(), tail_.end());
+    tail_.clear();
+    this->merge(std::move(chunks));
+}
+
+auto ChunkIndex::make_buckets(std::span<ChunkID const> ids) -> std::vector<std::uint32_t> {
+    auto const bits = bucket_bits(ids.size());
+    auto result = std::vector<std::uint32_t>(((std::size_t)1 << bits) + 1);
+    auto i = std::size_t{0};
+    for (std::size_t bucket = 0; bucket != result.size() - 1; ++bucket) {
+        result[bucket] = (std::uint32_t)i;
+        while (i != ids.size() && bucket_of(ids[i], bits) == bucket) {
+            ++i;
+        }
+    }
+    result.back() = (std::uint32_t)ids.size();
+    return result;
+}
+
+auto ChunkIndex::probe(std::span<std::uint32_t const> buckets, std::span<ChunkID const> ids, ChunkID chunkId) noexcept
+    -> std::size_t {
+    if (buckets.size() < 2 || !std::has_single_bit(buckets.size() - 1)) {
+        return npos;
+    }
+    auto const bucket = bucket_of(chunkId, std::countr_zero(buckets.size() - 1));
+    auto i = (std::size_t)buckets[bucket];
+    auto const end = std::min((std::size_t)buckets[bucket + 1], ids.size());
+#ifdef RLIB_CHUNKINDEX_SSE2
+    // compare two ids at once, id matches when both of its 32bit halves match
+    auto const key = _mm_set1_epi64x((long long)chunkId);
+    for (; i + 2 <= end; i += 2) {
+        auto const mask = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i const*)&ids[i]), key));
+        if ((mask & 0x00FF) == 0x00FF) {
+            return i;
+        }
+        if ((mask & 0xFF00) == 0xFF00) {
+            return i + 1;
+        }
+    }
+#endif
+    for (; i < end; ++i) {
+        if (ids[i] == chunkId) {
+            return i;
+        }
+    }
+    return npos;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "rchunk.hpp"
+
+namespace rlib {
+    // Flat chunk lookup: sorted ids and their entries are kept in separate arrays,
+    // directory over top bits of id narrows search down to a few ids.
+    struct ChunkIndex {
+        static constexpr std::size_t npos = (std::size_t)-1;
+
+        struct Entry {
+            std::uint32_t bundle;
+            std::uint32_t uncompressed_size;
+            std::uint32_t compressed_size;
+            std::array<std::uint32_t, 2> compressed_offset;
+
+            static constexpr auto from(RChunk::Src const& chunk, std::uint32_t bundle) noexcept -> Entry {
+                return {
+                    .bundle = bundle,
+                    .uncompressed_size = chunk.uncompressed_size,
+                    .compressed_size = chunk.compressed_size,
+                    .compressed_offset = std::bit_cast<std::array<std::uint32_t, 2>>(chunk.compressed_offset),
+                };
+            }
+
+            constexpr auto src(ChunkID chunkId, BundleID bundleId) const noexcept -> RChunk::Src {
+                return {{chunkId, uncompressed_size, compressed_size},
+                        bundleId,
+                        std::bit_cast<std::uint64_t>(compressed_offset)};
+            }
+        };
+        static_assert(sizeof(Entry) == 20);
+
+        ChunkIndex() = default;
+
+        // Duplicate ids keep first entry.
+        ChunkIndex(std::vector<std::pair<ChunkID, Entry>> chunks);
+
+        auto size() const noexcept -> std::size_t { return ids_.size() + tail_.size(); }
+
+        auto find(ChunkID chunkId) const noexcept -> Entry const*;
+
+        // Entries are first collected in small tail that gets folded into arrays once it grows.
+        auto insert(ChunkID chunkId, Entry const& entry) -> bool;
+
+        auto merge(std::vector<std::pair<ChunkID, Entry>> chunks) -> void;
+
+        auto compact() -> void;
+
+        // Arrays do not contain entries still in tail, call compact first.
+        auto buckets() const noexcept -> std::span<std::uint32_t const> { return buckets_; }
+
+        auto ids() const noexcept -> std::span<ChunkID const> { return ids_; }
+
+        auto entries() const noexcept -> std::span<Entry const> { return entries_; }
+
+        static auto make_buckets(std::span<ChunkID const> ids) -> std::vector<std::uint32_t>;
+
+        static auto probe(std::span<std::uint32_t const> buckets,
+                          std::span<ChunkID const> ids,
+                          ChunkID chunkId) noexcept -> std::size_t;
+
+    private:
+        std::vector<std::uint32_t> buckets_ = {};
+        std::vector<ChunkID> ids_ = {};
+        std::vector<Entry> entries_ = {};
+        std::unordered_map<ChunkID, Entry> tail_ = {};
+    };
+}
@@ -8,6 +8,10 @@
 #include <iomanip>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
 
 #include "buffer.hpp"
 
@@ -95,11 +99,108 @@ auto rlib::zstd_decompress(std::span<char const> src, std::size_t count) -> std:
     std::size_t size_decompressed = rlib_assert_zstd(ZSTD_findDecompressedSize(src.data(), src.size()));
     rlib_assert(size_decompressed == count);
     rlib_assert(buffer.resize_destroy(count));
-    std::size_t result = rlib_assert_zstd(ZSTD_decompress(buffer.data(), count, src.data(), src.size()));
+    std::size_t result = zstd_decompress_into(src, buffer);
     rlib_assert(result == size_decompressed);
     return buffer;
 }
 
+namespace {
+    // Digested dictionaries are expensive to create, they are made once and never freed.
+    struct ZstdDict {
+        std::string data;
+        std::unique_ptr<ZSTD_DDict, decltype(&ZSTD_freeDDict)> ddict = {nullptr, &ZSTD_freeDDict};
+        std::map<int, std::unique_ptr<ZSTD_CDict, decltype(&ZSTD_freeCDict)>> cdicts;
+    };
+
+    struct ZstdDicts {
+        std::shared_mutex mutex;
+        std::unordered_map<std::uint32_t, ZstdDict> dicts;
+    };
+}
+
+static auto zstd_dicts() noexcept -> ZstdDicts& {
+    static ZstdDicts instance = {};
+    return instance;
+}
+
+static auto zstd_ddict(std::uint32_t dict_id) -> ZSTD_DDict const* {
+    auto& dicts = zstd_dicts();
+    std::shared_lock lock(dicts.mutex);
+    auto i = dicts.dicts.find(dict_id);
+    return i != dicts.dicts.end() ? i->second.ddict.get() : nullptr;
+}
+
+static auto zstd_cdict(std::uint32_t dict_id, int level) -> ZSTD_CDict const* {
+    auto& dicts = zstd_dicts();
+    {
+        std::shared_lock lock(dicts.mutex);
+        auto i = dicts.dicts.find(dict_id);
+        rlib_assert(i != dicts.dicts.end());
+        if (auto j = i->second.cdicts.find(level); j != i->second.cdicts.end()) {
+            return j->second.get();
+        }
+    }
+    std::lock_guard lock(dicts.mutex);
+    auto& dict = dicts.dicts.at(dict_id);
+    auto& cdict = dict.cdicts.try_emplace(level, nullptr, &ZSTD_freeCDict).first->second;
+    if (!cdict) {
+        cdict.reset(ZSTD_createCDict(dict.data.data(), dict.data.size(), level));
+        rlib_assert(cdict);
+    }
+    return cdict.get();
+}
+
+auto rlib::zstd_decompress_into(std::span<char const> src, std::span<char> dst) -> std::size_t {
+    // creating context for every chunk costs more than decompressing small chunks
+    thread_local static auto ctx = std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)>(nullptr, &ZSTD_freeDCtx);
+    if (!ctx) {
+        ctx.reset(ZSTD_createDCtx());
+        rlib_assert(ctx);
+    }
+    if (auto const dict_id = (std::uint32_t)ZSTD_getDictID_fromFrame(src.data(), src.size())) {
+        auto const ddict = zstd_ddict(dict_id);
+        rlib_trace("dict_id: %08x", dict_id);
+        rlib_assert(ddict);
+        return rlib_assert_zstd(
+            ZSTD_decompress_usingDDict(ctx.get(), dst.data(), dst.size(), src.data(), src.size(), ddict));
+    }
+    return rlib_assert_zstd(ZSTD_decompressDCtx(ctx.get(), dst.data(), dst.size(), src.data(), src.size()));
+}
+
+auto rlib::zstd_compress_into(std::span<char const> src, std::span<char> dst, int level, std::uint32_t dict_id)
+    -> std::size_t {
+    thread_local static auto ctx = std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)>(nullptr, &ZSTD_freeCCtx);
+    if (!ctx) {
+        ctx.reset(ZSTD_createCCtx());
+        rlib_assert(ctx);
+    }
+    if (dict_id) {
+        auto const cdict = zstd_cdict(dict_id, level);
+        return rlib_assert_zstd(
+            ZSTD_compress_usingCDict(ctx.get(), dst.data(), dst.size(), src.data(), src.size(), cdict));
+    }
+    return rlib_assert_zstd(ZSTD_compressCCtx(ctx.get(), dst.data(), dst.size(), src.data(), src.size(), level));
+}
+
+auto rlib::zstd_dict_add(std::span<char const> dict) -> std::uint32_t {
+    auto const dict_id = (std::uint32_t)ZSTD_getDictID_fromDict(dict.data(), dict.size());
+    rlib_assert(dict_id);
+    auto& dicts = zstd_dicts();
+    std::lock_guard lock(dicts.mutex);
+    auto& entry = dicts.dicts[dict_id];
+    if (!entry.ddict) {
+        entry.data.assign(dict.begin(), dict.end());
+        entry.ddict.reset(ZSTD_createDDict(entry.data.data(), entry.data.size()));
+        rlib_assert(entry.ddict);
+    } else {
+        // same id must not be reused for different content
+        rlib_assert(entry.data == std::string_view(dict.data(), dict.size()));
+    }
+    return dict_id;
+}
+
+auto rlib::zstd_dict_contains(std::uint32_t dict_id) -> bool { return zstd_ddict(dict_id) != nullptr; }
+
 auto rlib::zstd_frame_decompress_size(std::span<char const> src) -> std::size_t {
     ZSTD_frameHeader header = {};
     rlib_assert_zstd(ZSTD_getFrameHeader(&header, src.data(), src.size()));
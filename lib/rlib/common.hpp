@@ -132,6 +132,22 @@ namespace rlib {
 
     extern auto zstd_decompress(std::span<char const> src, std::size_t count) -> std::span<char const>;
 
+    // Decompresses with context owned by calling thread, returns decompressed size.
+    // Frames referencing dictionary only decompress once that dictionary has been added.
+    extern auto zstd_decompress_into(std::span<char const> src, std::span<char> dst) -> std::size_t;
+
+    // Compresses with context owned by calling thread, returns compressed size.
+    // Non zero dict_id compresses with previously added dictionary.
+    extern auto zstd_compress_into(std::span<char const> src,
+                                   std::span<char> dst,
+                                   int level,
+                                   std::uint32_t dict_id = 0) -> std::size_t;
+
+    // Makes dictionary available to every thread for rest of process lifetime, returns its id.
+    extern auto zstd_dict_add(std::span<char const> dict) -> std::uint32_t;
+
+    extern auto zstd_dict_contains(std::uint32_t dict_id) -> bool;
+
     extern auto zstd_frame_decompress_size(std::span<char const> src) -> std::size_t;
 
     template <typename T, std::size_t S>
@@ -2,6 +2,7 @@
 
 #include <atomic>
 #include <bit>
+#include <cerrno>
 #include <cstring>
 #include <stdexcept>
 
@@ -32,14 +33,29 @@ private:
     static std::atomic_int count_;
 };
 
-auto IO::File::shrink_to_fit() noexcept -> bool {
-    if (!impl_.fd || !(impl_.flags & WRITE)) {
-        return false;
+auto IO::read_batch(std::span<ReadOp const> ops) const noexcept -> bool {
+    for (auto const& op : ops) {
+        if (!this->read(op.offset, op.dst)) {
+            return false;
+        }
     }
     return true;
 }
 
-auto IO::File::reserve(std::size_t offset, std::size_t count) noexcept -> bool {
+auto IO::write_batch(std::span<WriteOp const> ops) noexcept -> bool {
+    for (auto const& op : ops) {
+        if (!this->write(op.offset, op.src)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+auto IO::will_need(std::size_t offset, std::size_t count) const noexcept -> void {}
+
+auto IO::dont_need(std::size_t offset, std::size_t count) const noexcept -> void {}
+
+auto IO::File::shrink_to_fit() noexcept -> bool {
     if (!impl_.fd || !(impl_.flags & WRITE)) {
         return false;
     }
@@ -131,6 +147,22 @@ auto IO::File::resize(std::size_t offset, std::size_t count) noexcept -> bool {
     return true;
 }
 
+auto IO::File::reserve(std::size_t offset, std::size_t count) noexcept -> bool {
+    if (!impl_.fd || !(impl_.flags & WRITE)) {
+        return false;
+    }
+    std::uint64_t const total = (std::uint64_t)offset + count;
+    if (total < offset || total < count) {
+        return false;
+    }
+    if (impl_.flags & PREALLOCATE) {
+        FILE_ALLOCATION_INFO i = {.AllocationSize = {.QuadPart = (LONGLONG)total}};
+        // only a hint, file system might not support it
+        ::SetFileInformationByHandle((HANDLE)impl_.fd, FileAllocationInfo, &i, sizeof(i));
+    }
+    return true;
+}
+
 auto IO::File::read(std::size_t offset, std::span<char> dst) const noexcept -> bool {
     constexpr std::size_t CHUNK = 0x1000'0000;
     if (!impl_.fd) {
@@ -180,6 +212,18 @@ auto IO::File::write(std::uint64_t offset, std::span<char const> src) noexcept -
     return true;
 }
 
+auto IO::File::read_batch(std::span<ReadOp const> ops) const noexcept -> bool { return IO::read_batch(ops); }
+
+auto IO::File::write_batch(std::span<WriteOp const> ops) noexcept -> bool { return IO::write_batch(ops); }
+
+auto IO::File::will_need(std::size_t offset, std::size_t count) const noexcept -> void {}
+
+auto IO::File::dont_need(std::size_t offset, std::size_t count) const noexcept -> void {}
+
+auto IO::MMap::will_need(std::size_t offset, std::size_t count) const noexcept -> void {}
+
+auto IO::MMap::dont_need(std::size_t offset, std::size_t count) const noexcept -> void {}
+
 auto IO::MMap::Impl::remap(std::size_t count) noexcept -> bool {
     void* data = nullptr;
     if (count) {
@@ -207,11 +251,18 @@ auto IO::MMap::Impl::remap(std::size_t count) noexcept -> bool {
 
 #else
 #    include <fcntl.h>
+#    include <limits.h>
 #    include <signal.h>
 #    include <sys/mman.h>
 #    include <sys/param.h>
 #    include <sys/stat.h>
+#    include <sys/uio.h>
 #    include <unistd.h>
+#    if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#        include <linux/io_uring.h>
+#        include <sys/syscall.h>
+#        define RLIB_IO_URING
+#    endif
 std::atomic_int NoInterupt::lock_ = 0;
 std::atomic_int NoInterupt::count_ = [] {
     signal(SIGINT, [](int) {
@@ -245,6 +296,14 @@ IO::File::File(fs::path const& path, Flags flags) {
         auto ec = std::error_code((int)errno, std::system_category());
         throw_error("::fstat: ", ec);
     }
+#    ifdef POSIX_FADV_SEQUENTIAL
+    if (flags & SEQUENTIAL) {
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    if (flags & RANDOM_ACCESS) {
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    }
+#    endif
     impl_ = {.fd = (std::intptr_t)fd, .size = (std::size_t)size.st_size, .flags = flags};
 }
 
@@ -272,6 +331,26 @@ auto IO::File::resize(std::size_t offset, std::size_t count) noexcept -> bool {
     return true;
 }
 
+auto IO::File::reserve(std::size_t offset, std::size_t count) noexcept -> bool {
+    if (!impl_.fd || !(impl_.flags & WRITE)) {
+        return false;
+    }
+    std::uint64_t const total = (std::uint64_t)offset + count;
+    if (total < offset || total < count) {
+        return false;
+    }
+#    ifdef FALLOC_FL_KEEP_SIZE
+    if ((impl_.flags & PREALLOCATE) && count) {
+        // allocate extents up front so out of order writes do not fragment the file, size is left to resize
+        if (::fallocate((int)impl_.fd, FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)count) == -1) {
+            // only a hint, file system might not support it
+            return errno == EOPNOTSUPP || errno == ENOSYS;
+        }
+    }
+#    endif
+    return true;
+}
+
 auto IO::File::read(std::size_t offset, std::span<char> dst) const noexcept -> bool {
     if (!impl_.fd) {
         return false;
@@ -311,6 +390,302 @@ auto IO::File::write(std::uint64_t offset, std::span<char const> src) noexcept -
     return true;
 }
 
+// Ops that follow each other in file are merged into one vectored request.
+struct IORun {
+    std::size_t offset;
+    std::size_t size;
+    std::size_t iov_start;
+    std::size_t iov_count;
+};
+
+static auto io_op_span(IO::ReadOp const& op) noexcept -> std::span<char> { return op.dst; }
+
+static auto io_op_span(IO::WriteOp const& op) noexcept -> std::span<char> {
+    return {(char*)op.src.data(), op.src.size()};
+}
+
+template <typename Op>
+static auto io_runs(std::span<Op const> ops, std::vector<IORun>& runs, std::vector<iovec>& iovs) noexcept -> bool {
+    try {
+        runs.clear();
+        iovs.clear();
+        for (auto const& op : ops) {
+            auto const span = io_op_span(op);
+            if (op.offset + span.size() < op.offset) {
+                return false;
+            }
+            if (span.empty()) {
+                continue;
+            }
+            if (runs.empty() || runs.back().offset + runs.back().size != op.offset ||
+                runs.back().iov_count == IOV_MAX) {
+                runs.push_back({.offset = op.offset, .size = 0, .iov_start = iovs.size(), .iov_count = 0});
+            }
+            iovs.push_back({.iov_base = span.data(), .iov_len = span.size()});
+            runs.back().size += span.size();
+            runs.back().iov_count += 1;
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+// Finishes short transfer of run one iovec at a time.
+static auto io_finish(int fd, bool is_read, IORun const& run, iovec const* iovs, std::size_t done) noexcept -> bool {
+    auto offset = run.offset;
+    for (auto i = run.iov_start; i != run.iov_start + run.iov_count; ++i) {
+        auto data = std::span<char>((char*)iovs[i].iov_base, iovs[i].iov_len);
+        auto const skip = std::min(done, data.size());
+        data = data.subspan(skip);
+        offset += skip;
+        done -= skip;
+        while (!data.empty()) {
+            auto got = is_read ? ::pread(fd, data.data(), data.size(), offset)
+                               : ::pwrite(fd, data.data(), data.size(), offset);
+            if (got <= 0 || (std::size_t)got > data.size()) {
+                return false;
+            }
+            data = data.subspan(got);
+            offset += got;
+        }
+    }
+    return true;
+}
+
+static auto io_vectored(int fd, bool is_read, std::span<IORun const> runs, iovec const* iovs) noexcept -> bool {
+    for (auto const& run : runs) {
+        auto const got = is_read ? ::preadv(fd, iovs + run.iov_start, (int)run.iov_count, (off_t)run.offset)
+                                 : ::pwritev(fd, iovs + run.iov_start, (int)run.iov_count, (off_t)run.offset);
+        if (got < 0) {
+            return false;
+        }
+        if ((std::size_t)got < run.size && !io_finish(fd, is_read, run, iovs, (std::size_t)got)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#    ifdef RLIB_IO_URING
+// Minimal io_uring driven trough raw syscalls, ring is not thread safe so each thread gets its own.
+struct Uring {
+    static constexpr unsigned ENTRIES = 64;
+
+    static auto get() noexcept -> Uring* {
+        thread_local auto ring = Uring();
+        return ring.fd_ != -1 ? &ring : nullptr;
+    }
+
+    Uring() noexcept {
+        auto params = io_uring_params{};
+        fd_ = (int)::syscall(__NR_io_uring_setup, ENTRIES, &params);
+        if (fd_ < 0) {
+            fd_ = -1;
+            return;
+        }
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sq_ = map(sq_size_, IORING_OFF_SQ_RING);
+        cq_ = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ : map(cq_size_, IORING_OFF_CQ_RING);
+        sqes_ = (io_uring_sqe*)map(sqes_size_, IORING_OFF_SQES);
+        if (!sq_ || !cq_ || !sqes_) {
+            this->close();
+            return;
+        }
+        entries_ = std::min(params.sq_entries, ENTRIES);
+        sq_tail_ = (unsigned*)((char*)sq_ + params.sq_off.tail);
+        sq_mask_ = *(unsigned*)((char*)sq_ + params.sq_off.ring_mask);
+        sq_array_ = (unsigned*)((char*)sq_ + params.sq_off.array);
+        cq_head_ = (unsigned*)((char*)cq_ + params.cq_off.head);
+        cq_tail_ = (unsigned*)((char*)cq_ + params.cq_off.tail);
+        cq_mask_ = *(unsigned*)((char*)cq_ + params.cq_off.ring_mask);
+        cqes_ = (io_uring_cqe*)((char*)cq_ + params.cq_off.cqes);
+    }
+
+    Uring(Uring const&) = delete;
+
+    ~Uring() noexcept { this->close(); }
+
+    auto run(int fd, bool is_read, std::span<IORun const> runs, iovec const* iovs) noexcept -> bool {
+        auto ok = true;
+        while (!runs.empty()) {
+            auto const count = (unsigned)std::min(runs.size(), (std::size_t)entries_);
+            auto const tail = *sq_tail_;
+            for (unsigned i = 0; i != count; ++i) {
+                auto const index = (tail + i) & sq_mask_;
+                sqes_[index] = io_uring_sqe{};
+                sqes_[index].opcode = is_read ? IORING_OP_READV : IORING_OP_WRITEV;
+                sqes_[index].fd = fd;
+                sqes_[index].off = runs[i].offset;
+                sqes_[index].addr = (std::uintptr_t)(iovs + runs[i].iov_start);
+                sqes_[index].len = (unsigned)runs[i].iov_count;
+                sqes_[index].user_data = i;
+                sq_array_[index] = index;
+            }
+            __atomic_store_n(sq_tail_, tail + count, __ATOMIC_RELEASE);
+            for (unsigned submit = count, done = 0; done != count;) {
+                auto const result =
+                    (int)::syscall(__NR_io_uring_enter, fd_, submit, count - done, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (result < 0) {
+                    if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                        continue;
+                    }
+                    // submitted ops might still reference caller buffers, this ring can not be trusted anymore
+                    this->close();
+                    return false;
+                }
+                submit -= std::min((unsigned)result, submit);
+                auto head = *cq_head_;
+                for (auto const cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE); head != cq_tail; ++head) {
+                    auto const& cqe = cqes_[head & cq_mask_];
+                    auto const& run = runs[cqe.user_data];
+                    if (cqe.res < 0) {
+                        ok = false;
+                    } else if ((std::size_t)cqe.res < run.size) {
+                        // finish short transfers the slow way
+                        ok &= io_finish(fd, is_read, run, iovs, (std::size_t)cqe.res);
+                    }
+                    ++done;
+                }
+                __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            }
+            runs = runs.subspan(count);
+        }
+        return ok;
+    }
+
+private:
+    int fd_ = -1;
+    unsigned entries_ = {};
+    void* sq_ = {};
+    void* cq_ = {};
+    io_uring_sqe* sqes_ = {};
+    std::size_t sq_size_ = {};
+    std::size_t cq_size_ = {};
+    std::size_t sqes_size_ = {};
+    unsigned* sq_tail_ = {};
+    unsigned sq_mask_ = {};
+    unsigned* sq_array_ = {};
+    unsigned* cq_head_ = {};
+    unsigned* cq_tail_ = {};
+    unsigned cq_mask_ = {};
+    io_uring_cqe* cqes_ = {};
+
+    auto map(std::size_t size, off_t offset) noexcept -> void* {
+        auto result = ::mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+        return result == MAP_FAILED ? nullptr : result;
+    }
+
+    auto close() noexcept -> void {
+        if (sqes_) {
+            ::munmap(sqes_, sqes_size_);
+        }
+        if (cq_ && cq_ != sq_) {
+            ::munmap(cq_, cq_size_);
+        }
+        if (sq_) {
+            ::munmap(sq_, sq_size_);
+        }
+        if (fd_ != -1) {
+            ::close(fd_);
+        }
+        sq_ = cq_ = sqes_ = {};
+        fd_ = -1;
+    }
+};
+#    endif
+
+static auto io_submit(int fd, bool is_read, std::span<IORun const> runs, iovec const* iovs) noexcept -> bool {
+#    ifdef RLIB_IO_URING
+    if (runs.size() > 1) {
+        if (auto ring = Uring::get()) {
+            return ring->run(fd, is_read, runs, iovs);
+        }
+    }
+#    endif
+    return io_vectored(fd, is_read, runs, iovs);
+}
+
+auto IO::File::read_batch(std::span<ReadOp const> ops) const noexcept -> bool {
+    thread_local auto runs = std::vector<IORun>{};
+    thread_local auto iovs = std::vector<iovec>{};
+    if (!impl_.fd) {
+        return false;
+    }
+    if (ops.size() < 2) {
+        return IO::read_batch(ops);
+    }
+    if (!io_runs(ops, runs, iovs)) {
+        return false;
+    }
+    return io_submit((int)impl_.fd, true, runs, iovs.data());
+}
+
+auto IO::File::write_batch(std::span<WriteOp const> ops) noexcept -> bool {
+    thread_local auto runs = std::vector<IORun>{};
+    thread_local auto iovs = std::vector<iovec>{};
+    if (!impl_.fd || !(impl_.flags & WRITE)) {
+        return false;
+    }
+    if (ops.size() < 2) {
+        return IO::write_batch(ops);
+    }
+    if (!io_runs(ops, runs, iovs)) {
+        return false;
+    }
+    auto write_end = impl_.size;
+    for (auto const& run : runs) {
+        write_end = std::max(write_end, run.offset + run.size);
+    }
+    NoInterupt no_interupt_lock(impl_.flags & NO_INTERUPT);
+    if (!io_submit((int)impl_.fd, false, runs, iovs.data())) {
+        return false;
+    }
+    impl_.size = write_end;
+    return true;
+}
+
+auto IO::File::will_need(std::size_t offset, std::size_t count) const noexcept -> void {
+#    ifdef POSIX_FADV_WILLNEED
+    if (impl_.fd && count) {
+        ::posix_fadvise((int)impl_.fd, (off_t)offset, (off_t)count, POSIX_FADV_WILLNEED);
+    }
+#    endif
+}
+
+auto IO::File::dont_need(std::size_t offset, std::size_t count) const noexcept -> void {
+#    ifdef POSIX_FADV_DONTNEED
+    if (impl_.fd && count) {
+        ::posix_fadvise((int)impl_.fd, (off_t)offset, (off_t)count, POSIX_FADV_DONTNEED);
+    }
+#    endif
+}
+
+static auto mmap_advise(void* data, std::size_t capacity, std::size_t offset, std::size_t count, int advice) noexcept
+    -> void {
+    static auto const page_size = (std::size_t)::sysconf(_SC_PAGESIZE);
+    if (!data || !count || offset >= capacity) {
+        return;
+    }
+    // madvise wants page aligned start, mapping is shared so dropping partially used pages only costs a refault
+    auto const start = offset / page_size * page_size;
+    auto const end = std::min(offset + count, capacity);
+    ::madvise((char*)data + start, end - start, advice);
+}
+
+auto IO::MMap::will_need(std::size_t offset, std::size_t count) const noexcept -> void {
+    mmap_advise(impl_.data, impl_.capacity, offset, count, MADV_WILLNEED);
+}
+
+auto IO::MMap::dont_need(std::size_t offset, std::size_t count) const noexcept -> void {
+    mmap_advise(impl_.data, impl_.capacity, offset, count, MADV_DONTNEED);
+}
+
 auto IO::MMap::Impl::remap(std::size_t count) noexcept -> bool {
     void* data = nullptr;
     if (count) {
@@ -321,6 +696,11 @@ auto IO::MMap::Impl::remap(std::size_t count) noexcept -> bool {
         if (!data || (std::intptr_t)data == -1) [[unlikely]] {
             return false;
         }
+        if (flags & SEQUENTIAL) {
+            ::madvise(data, count, MADV_SEQUENTIAL);
+        } else if (flags & RANDOM_ACCESS) {
+            ::madvise(data, count, MADV_RANDOM);
+        }
     }
     if (this->data) {
         ::munmap(this->data, this->capacity);
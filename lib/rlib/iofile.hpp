@@ -21,6 +21,16 @@ namespace rlib {
 
         enum Flags : unsigned;
 
+        struct ReadOp {
+            std::size_t offset;
+            std::span<char> dst;
+        };
+
+        struct WriteOp {
+            std::size_t offset;
+            std::span<char const> src;
+        };
+
         virtual ~IO() noexcept = default;
 
         virtual auto fd() const noexcept -> std::intptr_t = 0;
@@ -43,6 +53,9 @@ namespace rlib {
             return this->read(offset, {(char*)dst.data(), dst.size() * sizeof(T)});
         }
 
+        // Reads every op, implementation may submit all of them at once.
+        virtual auto read_batch(std::span<ReadOp const> ops) const noexcept -> bool;
+
         virtual auto write(std::size_t offset, std::span<char const> src) noexcept -> bool = 0;
 
         template <typename T>
@@ -51,6 +64,15 @@ namespace rlib {
             return this->write(offset, {(char const*)src.data(), src.size() * sizeof(T)});
         }
 
+        // Writes every op, implementation may submit all of them at once.
+        virtual auto write_batch(std::span<WriteOp const> ops) noexcept -> bool;
+
+        // Hints that range is going to be read soon.
+        virtual auto will_need(std::size_t offset, std::size_t count) const noexcept -> void;
+
+        // Hints that range was consumed and can be dropped from page cache.
+        virtual auto dont_need(std::size_t offset, std::size_t count) const noexcept -> void;
+
         virtual auto copy(std::size_t offset, std::size_t count) const -> std::span<char const> = 0;
 
         template <typename T>
@@ -74,6 +96,7 @@ namespace rlib {
         RANDOM_ACCESS = 1 << 2,
         NO_INTERUPT = 1 << 3,
         NO_OVERGROW = 1 << 4,
+        PREALLOCATE = 1 << 5,
     };
 
     constexpr auto operator|(IO::Flags lhs, IO::Flags rhs) noexcept -> IO::Flags {
@@ -120,6 +143,15 @@ namespace rlib {
 
         auto copy(std::size_t offset, std::size_t count) const -> std::span<char const> override;
 
+        // Uses io_uring where kernel allows it, otherwise falls back to one syscall per op.
+        auto read_batch(std::span<ReadOp const> ops) const noexcept -> bool override;
+
+        auto write_batch(std::span<WriteOp const> ops) noexcept -> bool override;
+
+        auto will_need(std::size_t offset, std::size_t count) const noexcept -> void override;
+
+        auto dont_need(std::size_t offset, std::size_t count) const noexcept -> void override;
+
     private:
         struct Impl {
             std::intptr_t fd = {};
@@ -160,6 +192,10 @@ namespace rlib {
 
         auto copy(std::size_t offset, std::size_t count) const -> std::span<char const> override;
 
+        auto will_need(std::size_t offset, std::size_t count) const noexcept -> void override;
+
+        auto dont_need(std::size_t offset, std::size_t count) const noexcept -> void override;
+
     private:
         struct Impl {
             void* data = nullptr;
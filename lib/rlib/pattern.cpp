@@ -0,0 +1,106 @@
+#include "pattern.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+using namespace rlib;
+
+// ASCII only, same as what icase regex does for paths in default locale.
+static constexpr auto to_lower(char c) noexcept -> char { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+
+Pattern::Pattern(std::string const& pattern) {
+    if (!this->parse(pattern)) {
+        pieces_.clear();
+        anchor_begin_ = false;
+        anchor_end_ = false;
+        regex_.emplace(pattern, std::regex::optimize | std::regex::icase);
+    }
+}
+
+auto Pattern::parse(std::string_view pattern) -> bool {
+    if (pattern.starts_with('^')) {
+        anchor_begin_ = true;
+        pattern.remove_prefix(1);
+    }
+    if (pattern.ends_with('$')) {
+        // "\$" is plain dollar sign, unless backslash itself was escaped
+        auto const body = pattern.substr(0, pattern.size() - 1);
+        auto const slashes = body.size() - std::min(body.find_last_not_of('\\') + 1, body.size());
+        if (slashes % 2 == 0) {
+            anchor_end_ = true;
+            pattern = body;
+        }
+    }
+    pieces_.emplace_back();
+    for (std::size_t i = 0; i != pattern.size(); ++i) {
+        auto const c = pattern[i];
+        switch (c) {
+            case '\\':
+                // escaped punctuation is plain text, escaped letters and digits are classes or backrefs
+                if (++i == pattern.size() || std::isalnum((unsigned char)pattern[i])) {
+                    return false;
+                }
+                pieces_.back().push_back(to_lower(pattern[i]));
+                break;
+            case '.':
+                if (i + 1 == pattern.size() || pattern[i + 1] != '*') {
+                    return false;
+                }
+                ++i;
+                pieces_.emplace_back();
+                break;
+            case '[':
+            case ']':
+            case '(':
+            case ')':
+            case '{':
+            case '}':
+            case '*':
+            case '+':
+            case '?':
+            case '|':
+            case '^':
+            case '$':
+                return false;
+            default:
+                pieces_.back().push_back(to_lower(c));
+                break;
+        }
+    }
+    return true;
+}
+
+auto Pattern::operator()(std::string_view str) const -> bool {
+    if (regex_) {
+        return std::regex_search(str.begin(), str.end(), *regex_);
+    }
+    // paths are short, lowering them once lets every piece use plain memchr based find
+    thread_local auto lower = std::string{};
+    lower.resize(str.size());
+    std::transform(str.begin(), str.end(), lower.begin(), to_lower);
+    auto const view = std::string_view(lower);
+    auto pos = std::size_t{};
+    for (std::size_t i = 0; i != pieces_.size(); ++i) {
+        auto const& piece = pieces_[i];
+        auto const first = i == 0 && anchor_begin_;
+        if (i + 1 == pieces_.size() && anchor_end_) {
+            if (first) {
+                return view == piece;
+            }
+            return view.size() - pos >= piece.size() && view.ends_with(piece);
+        }
+        if (first) {
+            if (!view.starts_with(piece)) {
+                return false;
+            }
+            pos = piece.size();
+            continue;
+        }
+        auto const found = view.find(piece, pos);
+        if (found == std::string_view::npos) {
+            return false;
+        }
+        pos = found + piece.size();
+    }
+    return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rlib {
+    // Case insensitive regex search that skips regex engine for patterns made of plain text.
+    // Text pieces joined with ".*" and optionally anchored with '^' and '$' cover literal, prefix, suffix and glob
+    // style filters, anything else falls back to std::regex.
+    struct Pattern {
+        explicit Pattern(std::string const& pattern);
+
+        auto operator()(std::string_view str) const -> bool;
+
+        // True when pattern could not be reduced to text pieces.
+        auto is_regex() const noexcept -> bool { return regex_.has_value(); }
+
+    private:
+        std::vector<std::string> pieces_;
+        bool anchor_begin_ = {};
+        bool anchor_end_ = {};
+        std::optional<std::regex> regex_;
+
+        auto parse(std::string_view pattern) -> bool;
+    };
+}
@@ -6,10 +6,27 @@
 #include <bit>
 #include <cstring>
 
+#include "buffer.hpp"
 #include "common.hpp"
 
 using namespace rlib;
 
+static auto rbun_load_dicts(IO const& io, std::span<RChunk const> chunks) -> void {
+    auto buffer = Buffer{};
+    for (std::uint64_t compressed_offset = 0; auto const& chunk : chunks) {
+        if (RChunk::dict_chunk_id((std::uint32_t)chunk.chunkId) == chunk.chunkId &&
+            !zstd_dict_contains((std::uint32_t)chunk.chunkId)) {
+            rlib_trace("chunkId: %016llX", (unsigned long long)chunk.chunkId);
+            rlib_assert(buffer.resize_destroy(chunk.compressed_size));
+            rlib_assert(io.read(compressed_offset, buffer));
+            auto dict = zstd_decompress(buffer, chunk.uncompressed_size);
+            rlib_assert(RChunk::hash(dict, HashType::ZSTD_DICT) == chunk.chunkId);
+            zstd_dict_add(dict);
+        }
+        compressed_offset += chunk.compressed_size;
+    }
+}
+
 auto RBUN::read(IO const& io, bool no_lookup) -> RBUN {
     auto result = RBUN{};
     auto footer = Footer{};
@@ -40,14 +57,17 @@ auto RBUN::read(IO const& io, bool no_lookup) -> RBUN {
     }
 
     if (!no_lookup) {
-        result.lookup.reserve(footer.entry_count);
+        auto lookup = std::vector<std::pair<ChunkID, ChunkIndex::Entry>>{};
+        lookup.reserve(footer.entry_count);
         for (std::uint64_t compressed_offset = 0; auto const& chunk : result.chunks) {
             rlib_assert(in_range(compressed_offset, chunk.compressed_size, result.toc_offset));
             rlib_assert(chunk.uncompressed_size <= RChunk::LIMIT);
             rlib_assert(chunk.compressed_size <= ZSTD_compressBound(chunk.uncompressed_size));
-            result.lookup[chunk.chunkId] = RChunk::Src{chunk, result.bundleId, compressed_offset};
+            lookup.emplace_back(chunk.chunkId,
+                                ChunkIndex::Entry::from(RChunk::Src{chunk, result.bundleId, compressed_offset}, 0));
             compressed_offset += chunk.compressed_size;
         }
+        result.lookup = ChunkIndex(std::move(lookup));
     } else {
         for (std::uint64_t compressed_offset = 0; auto const& chunk : result.chunks) {
             rlib_assert(in_range(compressed_offset, chunk.compressed_size, result.toc_offset));
@@ -55,5 +75,6 @@ auto RBUN::read(IO const& io, bool no_lookup) -> RBUN {
             rlib_assert(chunk.compressed_size <= ZSTD_compressBound(chunk.uncompressed_size));
         }
     }
+    rbun_load_dicts(io, result.chunks);
     return result;
 }
@@ -3,9 +3,9 @@
 #include <cinttypes>
 #include <cstddef>
 #include <span>
-#include <unordered_map>
 #include <vector>
 
+#include "chunkindex.hpp"
 #include "iofile.hpp"
 #include "rchunk.hpp"
 
@@ -24,8 +24,9 @@ namespace rlib {
         BundleID bundleId = {};
         std::uint64_t toc_offset = {};
         std::vector<RChunk> chunks;
-        std::unordered_map<ChunkID, RChunk::Src> lookup;
+        ChunkIndex lookup;
 
+        // Zstd dictionaries stored in bundle are made available to zstd_decompress as soon as toc is read.
         static auto read(IO const& io, bool no_lookup = false) -> RBUN;
     };
 }
\ No newline at end of file
@@ -1,17 +1,24 @@
 #include "rcache.hpp"
 
 #include <common/xxhash.h>
+#include <zdict.h>
 #include <zstd.h>
 
+#include <algorithm>
 #include <charconv>
+#include <cstring>
 
 #include "buffer.hpp"
 #include "common.hpp"
 
 using namespace rlib;
 
+// Largest amount of compressed data read in one batch.
+static auto const RCACHE_BATCH_SIZE = 32 * MiB;
+
 static constexpr auto rcache_file_flags(bool readonly) -> IO::Flags {
-    return (readonly ? IO::READ : IO::WRITE) | IO::NO_INTERUPT | IO::NO_OVERGROW;
+    // chunk lookups jump all over the bundle, readahead only wastes page cache
+    return (readonly ? IO::READ | IO::RANDOM_ACCESS : IO::WRITE) | IO::NO_INTERUPT | IO::NO_OVERGROW;
 }
 
 static auto rcache_file_path(fs::path base, std::size_t index) -> fs::path {
@@ -19,21 +26,44 @@ static auto rcache_file_path(fs::path base, std::size_t index) -> fs::path {
     return std::move(base.replace_extension(fmt::format(".{:05d}.bundle", index)));
 }
 
+static auto rcache_bundle_chunks(ChunkIndex const& lookup,
+                                 std::uint32_t bundle,
+                                 std::vector<std::pair<ChunkID, ChunkIndex::Entry>>& chunks) -> void {
+    auto const ids = lookup.ids();
+    auto const entries = lookup.entries();
+    chunks.reserve(chunks.size() + ids.size());
+    for (std::size_t i = 0; i != ids.size(); ++i) {
+        auto entry = entries[i];
+        entry.bundle = bundle;
+        chunks.emplace_back(ids[i], entry);
+    }
+}
+
 RCache::RCache(Options const& options) : options_(options) {
     if (!options_.readonly) {
         options_.flush_size = std::max(1 * MiB, options_.flush_size);
         options_.max_size = std::max(options_.flush_size * 2, options_.max_size) - options_.flush_size;
     }
     if (fs::exists(options.path) && fs::is_directory(options.path)) {
+        can_write_index_ = options_.folder_index;
+        index_path_ = fs::path(options_.path) / ".idx";
         this->load_folder_internal();
     } else if (options_.readonly) {
+        index_path_ = fs::path(options_.path) += ".idx";
+        journal_path_ = fs::path(options_.path) += ".idj";
         this->load_file_internal_read_only();
     } else {
+        can_write_index_ = true;
+        index_path_ = fs::path(options_.path) += ".idx";
+        journal_path_ = fs::path(options_.path) += ".idj";
         this->load_file_internal_read_write();
     }
 }
 
-RCache::~RCache() { this->flush_internal(); }
+RCache::~RCache() {
+    this->flush_internal();
+    this->save_index_internal();
+}
 
 auto RCache::add(RChunk const& chunk, std::span<char const> data) -> bool {
     if (!can_write()) {
@@ -41,7 +71,7 @@ auto RCache::add(RChunk const& chunk, std::span<char const> data) -> bool {
     }
     rlib_assert(chunk.compressed_size == data.size());
     std::lock_guard lock(this->mutex_);
-    if (lookup_.contains(chunk.chunkId)) {
+    if (this->find_internal(chunk.chunkId)) {
         return false;
     }
     rlib_assert(chunk.compressed_size <= RChunk::LIMIT);
@@ -52,25 +82,52 @@ auto RCache::add(RChunk const& chunk, std::span<char const> data) -> bool {
 }
 
 auto RCache::add_uncompressed(std::span<char const> src, int level, HashType hash_type) -> RChunk::Src {
+    return this->add_compressed(this->compress(src, level, hash_type));
+}
+
+auto RCache::add_compressed(Compressed const& compressed) -> RChunk::Src {
     rlib_assert(can_write());
-    rlib_assert(src.size() <= RChunk::LIMIT);
-    rlib_assert(ZSTD_compressBound(src.size()) <= RChunk::LIMIT);
-    auto id = RChunk::hash(src, hash_type);
+    auto const& chunk = compressed.chunk;
+    if (compressed.data.empty()) {
+        std::shared_lock lock(this->mutex_);
+        auto c = this->find_internal(chunk.chunkId);
+        rlib_assert(c && c->uncompressed_size == chunk.uncompressed_size);
+        return *c;
+    }
+    rlib_assert(chunk.compressed_size == compressed.data.size());
     std::lock_guard lock(this->mutex_);
-    if (auto c = this->find_internal(id)) {
-        rlib_assert(c->uncompressed_size == src.size());
+    if (auto c = this->find_internal(chunk.chunkId)) {
+        rlib_assert(c->uncompressed_size == chunk.uncompressed_size);
         return *c;
     }
-    thread_local Buffer buffer = {};
+    this->add_internal(chunk, compressed.data);
+    return *this->find_internal(chunk.chunkId);
+}
+
+auto RCache::compress(std::span<char const> src, int level, HashType hash_type) const -> Compressed {
+    rlib_assert(src.size() <= RChunk::LIMIT);
+    return this->compress(src, level, RChunk::hash(src, hash_type));
+}
+
+auto RCache::compress(std::span<char const> src, int level, ChunkID chunkId) const -> Compressed {
+    rlib_assert(src.size() <= RChunk::LIMIT);
+    rlib_assert(ZSTD_compressBound(src.size()) <= RChunk::LIMIT);
+    auto result = Compressed{};
+    result.chunk.chunkId = chunkId;
+    result.chunk.uncompressed_size = src.size();
+    // Chunks already present are not compressed again, empty data marks them.
+    if (this->contains(result.chunk.chunkId)) {
+        return result;
+    }
+    auto& buffer = result.data;
     rlib_assert(buffer.resize_destroy(ZSTD_compressBound(src.size())));
-    auto size = rlib_assert_zstd(ZSTD_compress(buffer.data(), buffer.size(), src.data(), src.size(), level));
+    // dictionary itself has to be readable without dictionary
+    auto const dict_id = chunkId != RChunk::dict_chunk_id((std::uint32_t)chunkId) ? dict_id_ : 0;
+    auto size = zstd_compress_into(src, buffer, level, dict_id);
     rlib_assert(size <= RChunk::LIMIT);
-    auto chunk = RChunk::Src{};
-    chunk.chunkId = id;
-    chunk.uncompressed_size = src.size();
-    chunk.compressed_size = (std::uint32_t)size;
-    this->add_internal(chunk, buffer.subspan(0, size));
-    return chunk;
+    rlib_assert(buffer.resize_keep(size));
+    result.chunk.compressed_size = (std::uint32_t)size;
+    return result;
 }
 
 auto RCache::add_chunks(std::span<RChunk::Dst const> chunks) -> FileID {
@@ -80,9 +137,61 @@ auto RCache::add_chunks(std::span<RChunk::Dst const> chunks) -> FileID {
     return (FileID)result.chunkId;
 }
 
+auto RCache::set_dict(std::span<char const> dict) -> std::uint32_t {
+    rlib_assert(can_write());
+    auto const dict_id = zstd_dict_add(dict);
+    // compressed copy is kept even when cache already has dictionary, it gets written into every new bundle
+    auto compressed = Compressed{};
+    compressed.chunk.chunkId = RChunk::hash(dict, HashType::ZSTD_DICT);
+    compressed.chunk.uncompressed_size = dict.size();
+    rlib_assert(compressed.data.resize_destroy(ZSTD_compressBound(dict.size())));
+    auto const size = zstd_compress_into(dict, compressed.data, ZSTD_CLEVEL_DEFAULT);
+    rlib_assert(size <= RChunk::LIMIT);
+    rlib_assert(compressed.data.resize_keep(size));
+    compressed.chunk.compressed_size = (std::uint32_t)size;
+    std::lock_guard lock(this->mutex_);
+    auto const in_bundle = std::any_of(writer_.chunks.begin(), writer_.chunks.end(), [&](RChunk const& chunk) {
+        return chunk.chunkId == compressed.chunk.chunkId;
+    });
+    auto const known = this->find_internal(compressed.chunk.chunkId).has_value();
+    if (!known) {
+        this->add_internal(compressed.chunk, compressed.data);
+    }
+    dict_ = std::move(compressed);
+    if (known && !in_bundle) {
+        this->add_dict_copy_internal();
+    }
+    dict_id_ = dict_id;
+    return dict_id;
+}
+
+auto RCache::DictSamples::add(std::span<char const> src) -> void {
+    if (src.empty() || src.size() > SAMPLE_MAX || full()) {
+        return;
+    }
+    rlib_assert(data.append(src));
+    sizes.push_back(src.size());
+}
+
+auto RCache::DictSamples::train() const -> Buffer {
+    auto result = Buffer{};
+    rlib_assert(result.resize_destroy(dict_size));
+    auto const size = ZDICT_trainFromBuffer(result.data(),
+                                            result.size(),
+                                            data.data(),
+                                            sizes.data(),
+                                            (unsigned)sizes.size());
+    if (ZDICT_isError(size)) {
+        result.clear();
+        return result;
+    }
+    rlib_assert(result.resize_keep(size));
+    return result;
+}
+
 auto RCache::contains(ChunkID chunkId) const noexcept -> bool {
     std::shared_lock lock(this->mutex_);
-    return lookup_.contains(chunkId);
+    return this->find_internal(chunkId).has_value();
 }
 
 auto RCache::get(std::vector<RChunk::Dst> chunks, RChunk::Dst::data_cb on_data) const -> std::vector<RChunk::Dst> {
@@ -100,14 +209,52 @@ auto RCache::get(std::vector<RChunk::Dst> chunks, RChunk::Dst::data_cb on_data)
     }
     sort_by<&RChunk::Src::bundleId, &RChunk::Dst::compressed_offset, &RChunk::Dst::uncompressed_offset>(f, e);
 
-    auto last_id = ChunkID::None;
-    auto last_data = std::span<char const>{};
-    for (auto i = f; i != e; ++i) {
-        if (last_id == ChunkID::None || i->chunkId != last_id) {
-            last_data = zstd_decompress(this->get_internal(*i), i->uncompressed_size);
-            last_id = i->chunkId;
+    auto buffer = Buffer{};
+    auto ops = std::vector<IO::ReadOp>{};
+    auto srcs = std::vector<std::span<char const>>{};
+    for (auto i = f; i != e;) {
+        // Read compressed data for many chunks of same bundle at once, same chunks are next to each other.
+        auto j = i;
+        auto total = std::size_t{};
+        for (; j != e && j->bundleId == i->bundleId; ++j) {
+            if (j != i && j->chunkId == (j - 1)->chunkId) {
+                continue;
+            }
+            if (total && total + j->compressed_size > RCACHE_BATCH_SIZE) {
+                break;
+            }
+            total += j->compressed_size;
+        }
+        rlib_assert(buffer.resize_destroy(total));
+        ops.clear();
+        srcs.clear();
+        auto pos = std::size_t{};
+        for (auto k = i; k != j; ++k) {
+            if (k != i && k->chunkId == (k - 1)->chunkId) {
+                continue;
+            }
+            if (this->can_batch_internal(*k)) {
+                auto dst = buffer.subspan(pos, k->compressed_size);
+                ops.push_back({k->compressed_offset, dst});
+                srcs.push_back(dst);
+                pos += k->compressed_size;
+            } else {
+                srcs.push_back(this->get_internal(*k));
+            }
         }
-        on_data(*i, last_data);
+        if (!ops.empty()) {
+            rlib_assert(files_.at((std::size_t)i->bundleId)->read_batch(ops));
+        }
+        auto last_data = std::span<char const>{};
+        auto src = srcs.begin();
+        for (auto k = i; k != j; ++k) {
+            if (k == i || k->chunkId != (k - 1)->chunkId) {
+                this->load_dict_internal(*src);
+                last_data = zstd_decompress(*src++, k->uncompressed_size);
+            }
+            on_data(*k, last_data);
+        }
+        i = j;
     }
     chunks.resize(f - chunks.begin());
     return std::move(chunks);
@@ -118,7 +265,8 @@ auto RCache::get_into(RChunk const& chunk, std::span<char> dst) const -> bool {
     if (auto c = this->find_internal(chunk.chunkId); c) {
         rlib_assert(c->uncompressed_size == chunk.uncompressed_size);
         auto src = get_internal(*c);
-        auto result = rlib_assert_zstd(ZSTD_decompress(dst.data(), dst.size(), src.data(), src.size()));
+        this->load_dict_internal(src);
+        auto result = zstd_decompress_into(src, dst);
         rlib_assert(result == chunk.uncompressed_size);
         return true;
     }
@@ -132,7 +280,8 @@ auto RCache::get_chunks(FileID fileId) const -> std::vector<RChunk::Dst> {
         rlib_assert(c->uncompressed_size % sizeof(RChunk::Dst::Packed) == 0);
         auto src = get_internal(*c);
         auto dst = std::vector<RChunk::Dst::Packed>(count);
-        auto result = rlib_assert_zstd(ZSTD_decompress(dst.data(), c->uncompressed_size, src.data(), src.size()));
+        this->load_dict_internal(src);
+        auto result = zstd_decompress_into(src, {(char*)dst.data(), c->uncompressed_size});
         rlib_assert(result == c->uncompressed_size);
         auto converted = std::vector<RChunk::Dst>(dst.begin(), dst.end());
         for (auto offset = std::uint64_t{0}; auto& c : converted) {
@@ -144,15 +293,29 @@ auto RCache::get_chunks(FileID fileId) const -> std::vector<RChunk::Dst> {
     return {};
 }
 
-auto RCache::find_internal(ChunkID chunkId) const noexcept -> RChunk::Src const* {
+auto RCache::find_internal(ChunkID chunkId) const noexcept -> std::optional<RChunk::Src> {
     if (chunkId == ChunkID::None) {
-        return nullptr;
+        return std::nullopt;
+    }
+    if (auto entry = lookup_.find(chunkId)) {
+        return entry->src(chunkId, this->bundle_id_internal(entry->bundle));
     }
-    auto i = lookup_.find(chunkId);
-    if (i == lookup_.end()) {
-        return nullptr;
+    auto i = ChunkIndex::probe(index_.buckets, index_.ids, chunkId);
+    if (i == ChunkIndex::npos) {
+        return std::nullopt;
+    }
+    auto const& entry = index_.entries[i];
+    if (entry.bundle >= index_.bundles.size()) [[unlikely]] {
+        return std::nullopt;
+    }
+    return entry.src(chunkId, index_.bundles[entry.bundle].bundleId);
+}
+
+auto RCache::bundle_id_internal(std::uint32_t bundle) const noexcept -> BundleID {
+    if (files_.empty()) {
+        return bundle < bundles_.size() ? bundles_[bundle].bundleId : BundleID::None;
     }
-    return &i->second;
+    return (BundleID)bundle;
 }
 
 auto RCache::get_internal(RChunk::Src const& chunk) const -> std::span<char const> {
@@ -165,7 +328,7 @@ auto RCache::get_internal(RChunk::Src const& chunk) const -> std::span<char cons
         if (lazy.bundleId != chunk.bundleId) {
             auto path = fmt::format("{}/{}.bundle", options_.path, chunk.bundleId);
             lazy.bundleId = BundleID::None;
-            lazy.io = std::make_unique<IO::MMap>(path, IO::READ);
+            lazy.io = std::make_unique<IO::MMap>(path, IO::READ | IO::RANDOM_ACCESS);
             lazy.bundleId = chunk.bundleId;
         }
         return lazy.io->copy(chunk.compressed_offset, chunk.compressed_size);
@@ -180,6 +343,45 @@ auto RCache::get_internal(RChunk::Src const& chunk) const -> std::span<char cons
     }
 }
 
+auto RCache::can_batch_internal(RChunk::Src const& chunk) const noexcept -> bool {
+    // folder bundles are memory mapped and chunks still in write buffer are already in memory
+    if (files_.empty()) {
+        return false;
+    }
+    // only bundle that is being written is a file, every other one is mapped and decompressed from in place
+    auto const index = (std::size_t)chunk.bundleId;
+    if (index >= files_.size() || !(files_[index]->flags() & IO::WRITE)) {
+        return false;
+    }
+    return !(can_write() && index + 1 == files_.size() && chunk.compressed_offset >= writer_.toc_offset);
+}
+
+auto RCache::load_dict_internal(std::span<char const> src) const -> void {
+    auto const dict_id = (std::uint32_t)ZSTD_getDictID_fromFrame(src.data(), src.size());
+    if (!dict_id || zstd_dict_contains(dict_id)) {
+        return;
+    }
+    rlib_trace("dict_id: %08x", dict_id);
+    auto const chunkId = RChunk::dict_chunk_id(dict_id);
+    auto const c = this->find_internal(chunkId);
+    rlib_assert(c);
+    // caller still references data returned by get_internal, read dictionary into own buffer instead
+    auto data = Buffer{};
+    rlib_assert(data.resize_destroy(c->compressed_size));
+    if (files_.empty()) {
+        auto file = IO::File(fmt::format("{}/{}.bundle", options_.path, c->bundleId), IO::READ);
+        rlib_assert(file.read(c->compressed_offset, data));
+    } else if (this->can_batch_internal(*c)) {
+        rlib_assert(files_.at((std::size_t)c->bundleId)->read(c->compressed_offset, data));
+    } else {
+        auto const src = this->get_internal(*c);
+        std::memcpy(data.data(), src.data(), src.size());
+    }
+    auto dict = zstd_decompress(data, c->uncompressed_size);
+    rlib_assert(RChunk::hash(dict, HashType::ZSTD_DICT) == chunkId);
+    zstd_dict_add(dict);
+}
+
 auto RCache::add_internal(RChunk const& chunk, std::span<char const> data) -> void {
     // Space we will be adding this write
     auto const extra_data = sizeof(RChunk) + data.size();
@@ -187,6 +389,10 @@ auto RCache::add_internal(RChunk const& chunk, std::span<char const> data) -> vo
     if (writer_.chunks.size() && writer_.end_offset + extra_data > options_.max_size) {
         this->flush_internal();  // flush anything that we have atm
         auto const index = files_.size();
+        // bundle is done now so it can go into index
+        bundles_.push_back(index_bundle_internal(*files_.back(), (BundleID)(index - 1)));
+        index_dirty_ = true;
+        this->append_journal_internal((std::uint32_t)(index - 1));
         auto const path = rcache_file_path(options_.path, index);
         auto file = std::make_unique<IO::File>(path, rcache_file_flags(false));
         file->resize(0, 0);
@@ -196,9 +402,12 @@ auto RCache::add_internal(RChunk const& chunk, std::span<char const> data) -> vo
         writer_.chunks.clear();
         writer_.buffer.clear();
         this->flush_internal();
+        this->add_dict_copy_internal();
     }
     writer_.chunks.push_back(chunk);
-    lookup_[chunk.chunkId] = {chunk, (BundleID)(files_.size() - 1), writer_.buffer.size() + writer_.toc_offset};
+    auto const bundle = (std::uint32_t)(files_.size() - 1);
+    auto const compressed_offset = writer_.buffer.size() + writer_.toc_offset;
+    lookup_.insert(chunk.chunkId, ChunkIndex::Entry::from({chunk, (BundleID)bundle, compressed_offset}, bundle));
     rlib_assert(writer_.buffer.append(data));
     auto const buffer_size = writer_.buffer.size();
     auto const current_toc_size = files_.back()->size() - writer_.toc_offset;
@@ -208,6 +417,16 @@ auto RCache::add_internal(RChunk const& chunk, std::span<char const> data) -> vo
     writer_.end_offset += extra_data;
 }
 
+auto RCache::add_dict_copy_internal() -> void {
+    if (dict_.data.empty()) {
+        return;
+    }
+    // lookup keeps pointing at first copy, this one only makes bundle usable without the others
+    writer_.chunks.push_back(dict_.chunk);
+    rlib_assert(writer_.buffer.append(dict_.data));
+    writer_.end_offset += sizeof(RChunk) + dict_.data.size();
+}
+
 auto RCache::flush_internal() -> bool {
     // Dont reflush when there is nothing to flush.
     if (!can_write() || (writer_.buffer.empty() && writer_.toc_offset != 0)) {
@@ -230,21 +449,19 @@ auto RCache::flush_internal() -> bool {
 }
 
 auto RCache::load_file_internal_read_only() -> void {
+    auto paths = std::vector<std::pair<BundleID, fs::path>>{};
     fs::path path = options_.path;
     do {
         auto const index = files_.size();
-        auto file = std::make_unique<IO::MMap>(path, rcache_file_flags(true));
-        auto bundle = RBUN::read(*file);
-        files_.push_back(std::move(file));
-        for (auto& chunk : bundle.lookup) {
-            chunk.second.bundleId = (BundleID)index;
-        }
-        lookup_.merge(std::move(bundle.lookup));
+        files_.push_back(std::make_unique<IO::MMap>(path, rcache_file_flags(true)));
+        paths.emplace_back((BundleID)index, path);
         path = rcache_file_path(options_.path, index + 1);
     } while (fs::exists(path));
+    this->load_bundles_internal(paths);
 }
 
 auto RCache::load_file_internal_read_write() -> void {
+    auto paths = std::vector<std::pair<BundleID, fs::path>>{};
     fs::path path = options_.path;
     do {
         auto const index = files_.size();
@@ -256,14 +473,14 @@ auto RCache::load_file_internal_read_write() -> void {
         //    - size would not grow over limit
         if (!fs::exists(path) ||
             (!options_.newonly && !fs::exists(next_path) && fs::file_size(path) < options_.max_size)) {
+            this->load_bundles_internal(paths);
             auto file = std::make_unique<IO::File>(path, rcache_file_flags(false));
             auto size = file->size();
             auto bundle = size ? RBUN::read(*file) : RBUN{};
             files_.push_back(std::move(file));
-            for (auto& chunk : bundle.lookup) {
-                chunk.second.bundleId = (BundleID)index;
-            }
-            lookup_.merge(std::move(bundle.lookup));
+            auto chunks = std::vector<std::pair<ChunkID, ChunkIndex::Entry>>{};
+            rcache_bundle_chunks(bundle.lookup, (std::uint32_t)index, chunks);
+            lookup_.merge(std::move(chunks));
             writer_.toc_offset = bundle.toc_offset;
             writer_.end_offset = size;
             writer_.chunks = std::move(bundle.chunks);
@@ -272,18 +489,14 @@ auto RCache::load_file_internal_read_write() -> void {
             this->flush_internal();
             break;
         }
-        auto file = std::make_unique<IO::MMap>(path, rcache_file_flags(true));
-        auto bundle = RBUN::read(*file);
-        files_.push_back(std::move(file));
-        for (auto& chunk : bundle.lookup) {
-            chunk.second.bundleId = (BundleID)index;
-        }
-        lookup_.merge(std::move(bundle.lookup));
+        files_.push_back(std::make_unique<IO::MMap>(path, rcache_file_flags(true)));
+        paths.emplace_back((BundleID)index, path);
         path = std::move(next_path);
     } while (true);
 }
 
 auto RCache::load_folder_internal() -> void {
+    auto paths = std::vector<std::pair<BundleID, fs::path>>{};
     options_.readonly = true;
     for (auto const& entry : fs::directory_iterator(options_.path)) {
         auto const& path = entry.path();
@@ -295,12 +508,248 @@ auto RCache::load_folder_internal() -> void {
         auto [ptr, ec] = std::from_chars(filename.data(), filename.data() + 16, bundleId, 16);
         rlib_assert(ptr == filename.data() + 16);
         rlib_assert(ec == std::errc{});
+        paths.emplace_back((BundleID)bundleId, path);
+    }
+    // index and lookup refer to bundles by position in sorted list, directory iteration order is unspecified
+    sort_by<&std::pair<BundleID, fs::path>::first>(paths.begin(), paths.end());
+    this->load_bundles_internal(paths);
+}
+
+auto RCache::load_bundles_internal(std::vector<std::pair<BundleID, fs::path>> const& paths) -> void {
+    bundles_.reserve(paths.size());
+    for (auto const& [bundleId, path] : paths) {
+        auto file = IO::File(path, IO::READ);
+        bundles_.push_back(index_bundle_internal(file, bundleId));
+    }
+    // only bundles that are not in index or journal need to have their toc parsed
+    auto chunks = std::vector<std::pair<ChunkID, ChunkIndex::Entry>>{};
+    auto covered = std::vector<bool>(paths.size());
+    auto indexed = std::size_t{};
+    if (this->load_index_internal()) {
+        for (auto const position : index_.positions) {
+            covered[position] = true;
+        }
+        indexed = index_.bundles.size();
+    }
+    // journal is only written by file caches whose index always covers first bundles
+    for (auto i = indexed, end = this->load_journal_internal(indexed, chunks); i != end; ++i) {
+        covered[i] = true;
+    }
+    for (std::size_t i = 0; i != paths.size(); ++i) {
+        if (covered[i]) {
+            continue;
+        }
+        auto const& [bundleId, path] = paths[i];
         auto file = IO::File(path, IO::READ);
         auto bundle = RBUN::read(file);
-        rlib_assert(bundle.bundleId == (BundleID)bundleId);
-        for (auto& [key, value] : bundle.lookup) {
-            value.bundleId = bundle.bundleId;
+        rlib_assert(!files_.empty() || bundle.bundleId == bundleId);
+        rcache_bundle_chunks(bundle.lookup, (std::uint32_t)i, chunks);
+        index_dirty_ = true;
+    }
+    lookup_.merge(std::move(chunks));
+}
+
+auto RCache::load_index_internal() noexcept -> bool {
+    try {
+        if (index_path_.empty() || !fs::exists(index_path_)) {
+            return false;
+        }
+        index_.io = IO::MMap(index_path_, IO::READ | IO::RANDOM_ACCESS);
+        auto const& io = index_.io;
+        auto header = Index::Header{};
+        rlib_assert(io.read(0, {(char*)&header, sizeof(header)}));
+        rlib_assert(header.magic == Index::Header::MAGIC);
+        rlib_assert(header.version == Index::Header::VERSION);
+        rlib_assert(header.bundle_count <= bundles_.size());
+        rlib_assert(header.entry_count <= io.size());
+        auto const bundles_offset = sizeof(Index::Header);
+        auto const ids_offset = bundles_offset + sizeof(Index::Bundle) * header.bundle_count;
+        auto const entries_offset = ids_offset + sizeof(ChunkID) * header.entry_count;
+        auto const buckets_offset = entries_offset + sizeof(ChunkIndex::Entry) * header.entry_count;
+        rlib_assert(io.size() == buckets_offset + sizeof(std::uint32_t) * header.bucket_count);
+        index_.bundles = io.copy_s<Index::Bundle>(bundles_offset, header.bundle_count);
+        index_.ids = io.copy_s<ChunkID>(ids_offset, header.entry_count);
+        index_.entries = io.copy_s<ChunkIndex::Entry>(entries_offset, header.entry_count);
+        index_.buckets = io.copy_s<std::uint32_t>(buckets_offset, header.bucket_count);
+        // every indexed bundle must still exist unchanged, bundles that are not in index are parsed
+        index_.positions.clear();
+        index_.positions.reserve(index_.bundles.size());
+        for (auto const& bundle : index_.bundles) {
+            auto i = std::lower_bound(bundles_.begin(), bundles_.end(), bundle.bundleId, [](auto const& lhs, auto rhs) {
+                return lhs.bundleId < rhs;
+            });
+            rlib_assert(i != bundles_.end());
+            rlib_assert(std::memcmp(&*i, &bundle, sizeof(Index::Bundle)) == 0);
+            index_.positions.push_back((std::uint32_t)(i - bundles_.begin()));
         }
-        lookup_.merge(std::move(bundle.lookup));
+        return true;
+    } catch (std::exception const&) {
+        error_stack().clear();
+        index_ = {};
+        return false;
     }
-}
\ No newline at end of file
+}
+
+auto RCache::save_index_internal() noexcept -> bool {
+    if (!can_write_index_ || !index_dirty_) {
+        return false;
+    }
+    try {
+        auto chunks = std::vector<std::pair<ChunkID, ChunkIndex::Entry>>{};
+        chunks.reserve(index_.ids.size() + lookup_.size());
+        for (std::size_t i = 0; i != index_.ids.size(); ++i) {
+            // index refers to its own bundle list, new one is written from bundles_
+            auto entry = index_.entries[i];
+            if (entry.bundle < index_.positions.size()) {
+                entry.bundle = index_.positions[entry.bundle];
+                chunks.emplace_back(index_.ids[i], entry);
+            }
+        }
+        // chunks from bundle that is still being written are left out
+        lookup_.compact();
+        for (std::size_t i = 0; i != lookup_.ids().size(); ++i) {
+            if (auto const& entry = lookup_.entries()[i]; entry.bundle < bundles_.size()) {
+                chunks.emplace_back(lookup_.ids()[i], entry);
+            }
+        }
+        auto const merged = ChunkIndex(std::move(chunks));
+        auto const ids = merged.ids();
+        auto const entries = merged.entries();
+        auto const buckets = merged.buckets();
+        auto const header = Index::Header{
+            .magic = Index::Header::MAGIC,
+            .version = Index::Header::VERSION,
+            .bundle_count = (std::uint32_t)bundles_.size(),
+            .bucket_count = (std::uint32_t)buckets.size(),
+            .entry_count = ids.size(),
+        };
+        // old index can not be mapped while it is being replaced
+        index_ = {};
+        auto temp_path = index_path_;
+        temp_path += ".tmp";
+        {
+            auto outfile = IO::File(temp_path, IO::WRITE);
+            rlib_assert(outfile.resize(0, 0));
+            rlib_assert(outfile.write(outfile.size(), {(char const*)&header, sizeof(header)}));
+            rlib_assert(outfile.write(outfile.size(),
+                                      {(char const*)bundles_.data(), sizeof(Index::Bundle) * bundles_.size()}));
+            rlib_assert(outfile.write(outfile.size(), {(char const*)ids.data(), sizeof(ChunkID) * ids.size()}));
+            rlib_assert(outfile.write(outfile.size(),
+                                      {(char const*)entries.data(), sizeof(ChunkIndex::Entry) * entries.size()}));
+            rlib_assert(outfile.write(outfile.size(),
+                                      {(char const*)buckets.data(), sizeof(std::uint32_t) * buckets.size()}));
+        }
+        fs::rename(temp_path, index_path_);
+        index_dirty_ = false;
+        // journal only repeats what index has now, stale segments would be skipped anyway
+        fs::remove(journal_path_);
+        return true;
+    } catch (std::exception const&) {
+        error_stack().clear();
+        return false;
+    }
+}
+
+auto RCache::index_bundle_internal(IO const& io, BundleID bundleId) -> Index::Bundle {
+    auto result = Index::Bundle{.bundleId = bundleId, .size = io.size(), .footer = {}, .reserved = {}};
+    rlib_assert(result.size >= sizeof(RBUN::Footer));
+    rlib_assert(io.read(result.size - sizeof(RBUN::Footer), {(char*)&result.footer, sizeof(RBUN::Footer)}));
+    return result;
+}
+
+auto RCache::load_journal_internal(std::size_t indexed,
+                                   std::vector<std::pair<ChunkID, ChunkIndex::Entry>>& chunks) noexcept
+    -> std::size_t {
+    auto valid = std::size_t{};
+    try {
+        if (journal_path_.empty() || !fs::exists(journal_path_)) {
+            return indexed;
+        }
+        {
+            auto file = IO::File(journal_path_, IO::READ | IO::SEQUENTIAL);
+            auto ids = std::vector<ChunkID>{};
+            auto entries = std::vector<ChunkIndex::Entry>{};
+            // segments have to continue right where index ends, everything from first mismatch is dropped
+            for (auto segment = Index::Segment{};
+                 indexed < bundles_.size() && file.read(valid, {(char*)&segment, sizeof(segment)});) {
+                auto const ids_offset = valid + sizeof(Index::Segment);
+                auto const entries_offset = ids_offset + sizeof(ChunkID) * segment.entry_count;
+                auto const end_offset = entries_offset + sizeof(ChunkIndex::Entry) * segment.entry_count;
+                if (segment.magic != Index::Segment::MAGIC || segment.entry_count > file.size() ||
+                    end_offset > file.size() || segment.bundle.bundleId != (BundleID)indexed ||
+                    std::memcmp(&segment.bundle, &bundles_[indexed], sizeof(Index::Bundle)) != 0) {
+                    break;
+                }
+                ids.resize(segment.entry_count);
+                entries.resize(segment.entry_count);
+                rlib_assert(file.read_s<ChunkID>(ids_offset, ids));
+                rlib_assert(file.read_s<ChunkIndex::Entry>(entries_offset, entries));
+                for (std::size_t i = 0; i != ids.size(); ++i) {
+                    rlib_assert(entries[i].bundle == indexed);
+                    chunks.emplace_back(ids[i], entries[i]);
+                }
+                valid = end_offset;
+                ++indexed;
+                // index has to be rewritten on close to include segments
+                index_dirty_ = true;
+            }
+        }
+        if (can_write_index_) {
+            auto file = IO::File(journal_path_, IO::WRITE);
+            if (file.size() != valid) {
+                rlib_assert(file.resize(0, valid));
+            }
+        }
+        return indexed;
+    } catch (std::exception const&) {
+        error_stack().clear();
+        return indexed;
+    }
+}
+
+auto RCache::append_journal_internal(std::uint32_t bundle) noexcept -> bool {
+    if (!can_write_index_) {
+        return false;
+    }
+    auto old_size = std::size_t{};
+    try {
+        auto chunks = std::vector<std::pair<ChunkID, ChunkIndex::Entry>>{};
+        chunks.reserve(writer_.chunks.size());
+        for (auto const& chunk : writer_.chunks) {
+            if (auto entry = lookup_.find(chunk.chunkId); entry && entry->bundle == bundle) {
+                chunks.emplace_back(chunk.chunkId, *entry);
+            }
+        }
+        sort_by<&std::pair<ChunkID, ChunkIndex::Entry>::first>(chunks.begin(), chunks.end());
+        auto ids = std::vector<ChunkID>{};
+        auto entries = std::vector<ChunkIndex::Entry>{};
+        ids.reserve(chunks.size());
+        entries.reserve(chunks.size());
+        for (auto const& [chunkId, entry] : chunks) {
+            ids.push_back(chunkId);
+            entries.push_back(entry);
+        }
+        auto const segment = Index::Segment{
+            .magic = Index::Segment::MAGIC,
+            .reserved = {},
+            .entry_count = ids.size(),
+            .bundle = bundles_.at(bundle),
+        };
+        auto file = IO::File(journal_path_, IO::WRITE);
+        old_size = file.size();
+        rlib_assert(file.write(file.size(), {(char const*)&segment, sizeof(segment)}));
+        rlib_assert(file.write(file.size(), {(char const*)ids.data(), sizeof(ChunkID) * ids.size()}));
+        rlib_assert(file.write(file.size(), {(char const*)entries.data(), sizeof(ChunkIndex::Entry) * entries.size()}));
+        return true;
+    } catch (std::exception const&) {
+        error_stack().clear();
+        // partial segment would hide every segment after it
+        try {
+            auto file = IO::File(journal_path_, IO::WRITE);
+            file.resize(0, old_size);
+        } catch (std::exception const&) {
+            error_stack().clear();
+        }
+        return false;
+    }
+}
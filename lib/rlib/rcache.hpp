@@ -1,10 +1,12 @@
 #pragma once
 #include <cstddef>
+#include <optional>
 #include <shared_mutex>
 #include <span>
 #include <vector>
 
 #include "buffer.hpp"
+#include "chunkindex.hpp"
 #include "common.hpp"
 #include "iofile.hpp"
 #include "rbundle.hpp"
@@ -18,6 +20,31 @@ namespace rlib {
             bool newonly;
             std::size_t flush_size;
             std::size_t max_size;
+            // Bundle folders only get sidecar index written into them when asked to.
+            bool folder_index = {};
+        };
+
+        struct Compressed {
+            RChunk chunk;
+            Buffer data;
+        };
+
+        // Collects sample chunks to train zstd dictionary from.
+        struct DictSamples {
+            std::size_t dict_size;
+            Buffer data = {};
+            std::vector<std::size_t> sizes = {};
+
+            // Large chunks gain little from dictionary and would crowd out small ones.
+            static constexpr std::size_t SAMPLE_MAX = 128 * 1024;
+            static constexpr std::size_t SAMPLE_RATIO = 100;
+
+            auto add(std::span<char const> src) -> void;
+
+            auto full() const noexcept -> bool { return data.size() >= dict_size * SAMPLE_RATIO; }
+
+            // Returns empty dictionary when there is not enough samples to train from.
+            auto train() const -> Buffer;
         };
 
         RCache(Options const& options);
@@ -28,8 +55,20 @@ namespace rlib {
         auto add_uncompressed(std::span<char const> data, int level, HashType hash_type = HashType::RITO_HKDF)
             -> RChunk::Src;
 
+        auto add_compressed(Compressed const& compressed) -> RChunk::Src;
+
+        auto compress(std::span<char const> data, int level, HashType hash_type = HashType::RITO_HKDF) const
+            -> Compressed;
+
+        // Same as compress for data that was already hashed.
+        auto compress(std::span<char const> data, int level, ChunkID chunkId) const -> Compressed;
+
         auto add_chunks(std::span<RChunk::Dst const> chunks) -> FileID;
 
+        // Stores dictionary as chunk and compresses every following chunk with it, returns dictionary id.
+        // Every bundle written from then on carries its own copy so it can be decoded on its own.
+        auto set_dict(std::span<char const> dict) -> std::uint32_t;
+
         auto contains(ChunkID chunkId) const noexcept -> bool;
 
         auto get(std::vector<RChunk::Dst> chunks, RChunk::Dst::data_cb read) const -> std::vector<RChunk::Dst>;
@@ -47,11 +86,58 @@ namespace rlib {
             std::vector<RChunk> chunks;
             Buffer buffer;
         };
+        // Sidecar file with chunks of all finished bundles sorted by id, used directly from mmap.
+        // Bundles finished since it was written are appended to journal as segments, both are merged on close.
+        // Folder index is keyed by bundle id, bundles added to folder are parsed and ones removed invalidate it.
+        struct Index {
+            struct Header {
+                static constexpr std::array<char, 4> MAGIC = {'R', 'I', 'D', 'X'};
+                static constexpr std::uint32_t VERSION = 2;
+
+                std::array<char, 4> magic;
+                std::uint32_t version;
+                std::uint32_t bundle_count;
+                std::uint32_t bucket_count;
+                std::uint64_t entry_count;
+            };
+            struct Bundle {
+                BundleID bundleId;
+                std::uint64_t size;
+                RBUN::Footer footer;
+                std::uint32_t reserved;
+            };
+            // Journal segment, followed by sorted ids and entries of one bundle.
+            struct Segment {
+                static constexpr std::array<char, 4> MAGIC = {'R', 'I', 'D', 'J'};
+
+                std::array<char, 4> magic;
+                std::uint32_t reserved;
+                std::uint64_t entry_count;
+                Bundle bundle;
+            };
+            IO::MMap io = {};
+            std::span<Bundle const> bundles = {};
+            std::span<ChunkID const> ids = {};
+            std::span<ChunkIndex::Entry const> entries = {};
+            std::span<std::uint32_t const> buckets = {};
+            // position of every indexed bundle in bundles_
+            std::vector<std::uint32_t> positions = {};
+        };
         bool can_write_ = {};
+        bool can_write_index_ = {};
+        bool index_dirty_ = {};
+        std::uint32_t dict_id_ = {};
+        Compressed dict_ = {};
         Options options_ = {};
         Writer writer_ = {};
         std::vector<std::unique_ptr<IO>> files_;
-        std::unordered_map<ChunkID, RChunk::Src> lookup_ = {};
+        // entries refer to bundles by position, in folder mode that is position in bundles_
+        ChunkIndex lookup_ = {};
+        // folder caches never add bundles so they have no journal
+        fs::path index_path_ = {};
+        fs::path journal_path_ = {};
+        Index index_ = {};
+        std::vector<Index::Bundle> bundles_ = {};
         mutable std::shared_mutex mutex_;
 
         auto load_file_internal_read_write() -> void;
@@ -60,12 +146,34 @@ namespace rlib {
 
         auto load_folder_internal() -> void;
 
+        auto load_bundles_internal(std::vector<std::pair<BundleID, fs::path>> const& paths) -> void;
+
+        auto load_index_internal() noexcept -> bool;
+
+        auto save_index_internal() noexcept -> bool;
+
+        auto load_journal_internal(std::size_t indexed,
+                                   std::vector<std::pair<ChunkID, ChunkIndex::Entry>>& chunks) noexcept
+            -> std::size_t;
+
+        auto append_journal_internal(std::uint32_t bundle) noexcept -> bool;
+
+        static auto index_bundle_internal(IO const& io, BundleID bundleId) -> Index::Bundle;
+
         auto add_internal(RChunk const& chunk, std::span<char const> data) -> void;
 
-        auto find_internal(ChunkID chunkId) const noexcept -> RChunk::Src const*;
+        auto find_internal(ChunkID chunkId) const noexcept -> std::optional<RChunk::Src>;
+
+        auto bundle_id_internal(std::uint32_t bundle) const noexcept -> BundleID;
 
         auto get_internal(RChunk::Src const& chunk) const -> std::span<char const>;
 
+        auto can_batch_internal(RChunk::Src const& chunk) const noexcept -> bool;
+
+        auto load_dict_internal(std::span<char const> src) const -> void;
+
+        auto add_dict_copy_internal() -> void;
+
         auto flush_internal() -> bool;
     };
 }
\ No newline at end of file
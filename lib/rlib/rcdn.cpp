@@ -3,9 +3,20 @@
 #include <curl/curl.h>
 #include <zstd.h>
 
+#ifdef __linux__
+#    include <sys/epoll.h>
+#    include <unistd.h>
+#endif
+
+#include <bit>
+#include <cerrno>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <future>
 #include <map>
+#include <mutex>
 
 #include "buffer.hpp"
 #include "common.hpp"
@@ -17,6 +28,151 @@ struct CurlInit {
     ~CurlInit() noexcept { curl_global_cleanup(); }
 };
 
+// Decompresses received chunks on thread pool so network thread only has to receive data.
+struct RCDN::Decoder final {
+    Decoder(RCDN const* cdn, ThreadPool* pool, RChunk::Dst::data_cb const& on_data) noexcept
+        : cdn_(cdn), pool_(pool), on_data_(on_data) {}
+    Decoder(Decoder const&) = delete;
+    ~Decoder() noexcept { this->wait(); }
+
+    // Chunks must all have same id and stay alive untill wait.
+    auto push(std::span<RChunk::Dst const> chunks, std::span<char const> src) -> void {
+        auto data = std::make_shared<Buffer>();
+        rlib_assert(data->append(src.subspan(0, chunks.front().compressed_size)));
+        // pool blocks when it has too many queued chunks which stops receiving untill it catches up
+        jobs_.push_back(pool_->submit([this, chunks, data] {
+            auto done = std::size_t{0};
+            auto error = std::string{};
+            try {
+                auto dst = cdn_->decompress_internal(chunks.front(), *data);
+                std::lock_guard lock(mutex_);
+                for (; done != chunks.size(); ++done) {
+                    on_data_(chunks[done], dst);
+                }
+            } catch (std::exception const& e) {
+                error = e.what();
+                error_stack().clear();
+            }
+            if (done != chunks.size()) {
+                std::lock_guard lock(mutex_);
+                failed_.insert(failed_.end(), chunks.begin() + done, chunks.end());
+                if (!error.empty()) {
+                    error_ = std::move(error);
+                }
+            }
+        }));
+        while (!jobs_.empty() && jobs_.front().wait_for(std::chrono::seconds{0}) == std::future_status::ready) {
+            jobs_.pop_front();
+        }
+    }
+
+    auto wait() noexcept -> void {
+        for (auto& job : jobs_) {
+            job.wait();
+        }
+        jobs_.clear();
+    }
+
+    auto finish(std::vector<RChunk::Dst>& chunks_failed, Stats& stats) -> void {
+        this->wait();
+        chunks_failed.insert(chunks_failed.end(), failed_.begin(), failed_.end());
+        failed_.clear();
+        if (!error_.empty()) {
+            stats.error = std::move(error_);
+            error_.clear();
+        }
+    }
+
+private:
+    RCDN const* cdn_;
+    ThreadPool* pool_;
+    RChunk::Dst::data_cb on_data_;
+    std::mutex mutex_;
+    std::vector<RChunk::Dst> failed_;
+    std::string error_;
+    std::deque<std::future<void>> jobs_;
+};
+
+// Drives curl multi handle, with epoll curl is only called for sockets that are ready.
+struct RCDN::Events final {
+#ifdef __linux__
+    Events(void* handle) : handle_(handle), epoll_(::epoll_create1(EPOLL_CLOEXEC)) {
+        rlib_assert(epoll_ != -1);
+        rlib_assert_multi_curl(curl_multi_setopt(handle_, CURLMOPT_SOCKETFUNCTION, &on_socket));
+        rlib_assert_multi_curl(curl_multi_setopt(handle_, CURLMOPT_SOCKETDATA, this));
+        rlib_assert_multi_curl(curl_multi_setopt(handle_, CURLMOPT_TIMERFUNCTION, &on_timer));
+        rlib_assert_multi_curl(curl_multi_setopt(handle_, CURLMOPT_TIMERDATA, this));
+    }
+    Events(Events const&) = delete;
+    ~Events() noexcept { ::close(epoll_); }
+
+    auto perform(int interval) -> void {
+        using namespace std::chrono;
+        auto timeout = interval;
+        if (deadline_) {
+            auto left = (long long)duration_cast<milliseconds>(*deadline_ - steady_clock::now()).count();
+            timeout = (int)std::clamp(left, 0ll, (long long)interval);
+        }
+        epoll_event events[64];
+        auto count = ::epoll_wait(epoll_, events, 64, timeout);
+        int still_running = 0;
+        for (int i = 0; i < count; ++i) {
+            auto const flags = ((events[i].events & EPOLLIN) ? CURL_CSELECT_IN : 0) |
+                               ((events[i].events & EPOLLOUT) ? CURL_CSELECT_OUT : 0) |
+                               ((events[i].events & (EPOLLERR | EPOLLHUP)) ? CURL_CSELECT_ERR : 0);
+            rlib_assert_multi_curl(curl_multi_socket_action(handle_, events[i].data.fd, flags, &still_running));
+        }
+        // socket activity alone must not starve curl timeouts
+        if (deadline_ && *deadline_ <= steady_clock::now()) {
+            deadline_ = std::nullopt;
+            rlib_assert_multi_curl(curl_multi_socket_action(handle_, CURL_SOCKET_TIMEOUT, 0, &still_running));
+        }
+    }
+
+private:
+    void* handle_;
+    int epoll_;
+    std::optional<std::chrono::steady_clock::time_point> deadline_;
+
+    static auto on_socket(CURL*, curl_socket_t socket, int what, Events* self, void*) noexcept -> int {
+        if (what == CURL_POLL_REMOVE) {
+            ::epoll_ctl(self->epoll_, EPOLL_CTL_DEL, socket, nullptr);
+            return 0;
+        }
+        auto event = epoll_event{};
+        event.events = ((what & CURL_POLL_IN) ? EPOLLIN : 0u) | ((what & CURL_POLL_OUT) ? EPOLLOUT : 0u);
+        event.data.fd = socket;
+        if (::epoll_ctl(self->epoll_, EPOLL_CTL_MOD, socket, &event) == -1 && errno == ENOENT) {
+            ::epoll_ctl(self->epoll_, EPOLL_CTL_ADD, socket, &event);
+        }
+        return 0;
+    }
+
+    static auto on_timer(CURLM*, long timeout_ms, Events* self) noexcept -> int {
+        if (timeout_ms < 0) {
+            self->deadline_ = std::nullopt;
+        } else {
+            self->deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds{timeout_ms};
+        }
+        return 0;
+    }
+#else
+    Events(void* handle) : handle_(handle) {}
+
+    auto perform(int interval) -> void {
+        // Block first so finished transfers are read and workers restarted before next wait.
+        // Freshly added handles make curl timeout expire right away so they are not delayed either.
+        rlib_assert_multi_curl(curl_multi_wait(handle_, nullptr, 0, interval, nullptr));
+        // NOTE: i do not trust still_running out variable, do our own bookkeeping instead.
+        int still_running = 0;
+        rlib_assert_multi_curl(curl_multi_perform(handle_, &still_running));
+    }
+
+private:
+    void* handle_;
+#endif
+};
+
 struct RCDN::Worker final {
     Worker(RCDN const* cdn) : cdn_(cdn), handle_(curl_easy_init()) {
         auto& options = cdn_->options_;
@@ -56,8 +212,8 @@ struct RCDN::Worker final {
         }
     }
 
-    auto start(std::span<RChunk::Dst const>& chunks_queue, RChunk::Dst::data_cb on_data) -> void* {
-        auto chunks = find_chunks(chunks_queue);
+    auto start(std::span<RChunk::Dst const>& chunks_queue, Decoder* decoder) -> void* {
+        auto chunks = find_chunks(chunks_queue, cdn_->options_.merge_gap, cdn_->options_.max_range);
         auto const& front = chunks.front();
         auto const& back = chunks.back();
         auto range = fmt::format("{}-{}", front.compressed_offset, back.compressed_offset + back.compressed_size - 1);
@@ -65,18 +221,28 @@ struct RCDN::Worker final {
         rlib_assert_easy_curl(curl_easy_setopt(handle_, CURLOPT_URL, url.c_str()));
         rlib_assert_easy_curl(curl_easy_setopt(handle_, CURLOPT_RANGE, range.c_str()));
         buffer_.clear();
+        position_ = front.compressed_offset;
         chunks_ = chunks;
-        on_data_ = on_data;
+        decoder_ = decoder;
+        started_ = std::chrono::steady_clock::now();
         error_.clear();
         chunks_queue = chunks_queue.subspan(chunks.size());
         return handle_;
     }
 
-    auto finish(std::vector<RChunk::Dst>& chunks_failed) -> void* {
+    auto finish(std::vector<RChunk::Dst>& chunks_failed, Stats& stats) -> void* {
+        auto elapsed = std::chrono::steady_clock::now() - started_;
+        auto ms = (std::uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+        stats.latency[std::min((std::size_t)std::bit_width(ms), stats.latency.size() - 1)] += 1;
+        stats.requests += 1;
+        stats.failed += !chunks_.empty();
+        if (!error_.empty()) {
+            stats.error = error_;
+        }
         chunks_failed.insert(chunks_failed.end(), chunks_.begin(), chunks_.end());
         buffer_.clear();
         chunks_ = {};
-        on_data_ = {};
+        decoder_ = {};
         return handle_;
     }
 
@@ -86,6 +252,7 @@ struct RCDN::Worker final {
         rlib_assert_easy_curl(curl_easy_setopt(handle_, CURLOPT_URL, url.c_str()));
         rlib_assert_easy_curl(curl_easy_setopt(handle_, CURLOPT_RANGE, range.c_str()));
         buffer_.clear();
+        position_ = chunk.compressed_offset;
         RChunk::Dst dummy_chunks[1] = {{chunk}};
         chunks_ = dummy_chunks;
         auto dumm_cb = [dst](RChunk::Dst const& chunk, std::span<char const> src) {
@@ -103,12 +270,33 @@ struct RCDN::Worker final {
         return result && chunks_.empty();
     }
 
+    // Plain range request, range is in same form as http Range header so "-N" means last N bytes.
+    auto get_range(BundleID bundleId, std::string const& range) -> Buffer {
+        auto url = fmt::format("{}/bundles/{}.bundle", cdn_->options_.url, bundleId);
+        rlib_assert_easy_curl(curl_easy_setopt(handle_, CURLOPT_URL, url.c_str()));
+        rlib_assert_easy_curl(curl_easy_setopt(handle_, CURLOPT_RANGE, range.c_str()));
+        auto result = Buffer{};
+        raw_ = &result;
+        error_.clear();
+        auto const code = curl_easy_perform(handle_);
+        raw_ = nullptr;
+        if (!error_.empty()) {
+            throw std::runtime_error(this->error_);
+        }
+        rlib_assert(code == CURLE_OK);
+        return result;
+    }
+
 private:
     RCDN const* cdn_;
     void* handle_;
     Buffer buffer_;
+    std::uint64_t position_;
     std::span<RChunk::Dst const> chunks_;
     RChunk::Dst::data_cb on_data_;
+    Decoder* decoder_ = {};
+    Buffer* raw_ = {};
+    std::chrono::steady_clock::time_point started_ = {};
     std::string error_;
 
     auto recieve(std::span<char const> recv) -> bool {
@@ -117,15 +305,24 @@ private:
                 return false;
             }
             auto chunk = chunks_.front();
+            // Skip unused data between chunks that were merged into same range.
+            if (position_ < chunk.compressed_offset) {
+                auto nsize = std::min((std::uint64_t)recv.size(), chunk.compressed_offset - position_);
+                recv = recv.subspan(nsize);
+                position_ += nsize;
+                continue;
+            }
             if (buffer_.empty() && recv.size() >= chunk.compressed_size) {
                 decompress(chunk, recv);
                 recv = recv.subspan(chunk.compressed_size);
+                position_ += chunk.compressed_size;
             } else if (buffer_.size() + recv.size() >= chunk.compressed_size) {
                 auto nsize = chunk.compressed_size - buffer_.size();
                 rlib_assert(buffer_.append(recv.subspan(0, nsize)));
                 decompress(chunk, buffer_);
                 buffer_.clear();
                 recv = recv.subspan(nsize);
+                position_ += chunk.compressed_size;
             } else {
                 if (!buffer_.append(recv)) {
                     return false;
@@ -137,13 +334,16 @@ private:
     }
 
     auto decompress(RChunk::Dst const& chunk, std::span<char const> src) -> bool {
-        src = src.subspan(0, chunk.compressed_size);
-        auto compressed_size = rlib_assert_zstd(ZSTD_findFrameCompressedSize(src.data(), src.size()));
-        rlib_assert(compressed_size == chunk.compressed_size);
-        auto dst = zstd_decompress(src, chunk.uncompressed_size);
-        if (cdn_->cache_ && cdn_->cache_->can_write()) {
-            cdn_->cache_->add(chunk, src);
+        if (decoder_) {
+            auto count = std::size_t{1};
+            while (count != chunks_.size() && chunks_[count].chunkId == chunk.chunkId) {
+                ++count;
+            }
+            decoder_->push(chunks_.subspan(0, count), src);
+            chunks_ = chunks_.subspan(count);
+            return true;
         }
+        auto dst = cdn_->decompress_internal(chunk, src);
         while (!chunks_.empty() && chunks_.front().chunkId == chunk.chunkId) {
             on_data_(chunks_.front(), dst);
             chunks_ = chunks_.subspan(1);
@@ -151,19 +351,26 @@ private:
         return true;
     }
 
-    static auto find_chunks(std::span<RChunk::Dst const> chunks) noexcept -> std::span<RChunk::Dst const> {
+    static auto find_chunks(std::span<RChunk::Dst const> chunks, std::size_t merge_gap, std::size_t max_range) noexcept
+        -> std::span<RChunk::Dst const> {
         std::size_t i = 1;
         for (; i != chunks.size(); ++i) {
             // 1. Consecutive chunks must be present in same bundle
             if (chunks[i].bundleId != chunks[0].bundleId) {
                 break;
             }
-            // 2. Chunks with same id don't follow 3. but are allowed.
+            // 2. Chunks with same id don't follow 3. and 4. but are allowed.
             if (chunks[i].chunkId == chunks[i - 1].chunkId) {
                 continue;
             }
-            // 3. Consecutive chunks should be contigous in memory.
-            if (chunks[i].compressed_offset != chunks[i - 1].compressed_offset + chunks[i - 1].compressed_size) {
+            // 3. Consecutive chunks should be contigous in memory or have small enough gap between them.
+            auto const prev_end = chunks[i - 1].compressed_offset + chunks[i - 1].compressed_size;
+            if (chunks[i].compressed_offset < prev_end || chunks[i].compressed_offset - prev_end > merge_gap) {
+                break;
+            }
+            // 4. Whole range should not grow over limit.
+            auto const range_end = chunks[i].compressed_offset + chunks[i].compressed_size;
+            if (max_range && range_end - chunks[0].compressed_offset > max_range) {
                 break;
             }
         }
@@ -175,6 +382,9 @@ private:
             return 0;
         }
         try {
+            if (self->raw_) {
+                return self->raw_->append({data, size * ncount}) ? size * ncount : 0;
+            }
             if (self->recieve({data, size * ncount})) {
                 return size * ncount;
             }
@@ -213,6 +423,8 @@ auto RCDN::get(std::vector<RChunk::Dst> chunks, RChunk::Dst::data_cb on_data) ->
         for (std::uint32_t i = std::clamp(options_.workers, 1u, 64u); i; --i) {
             workers_.push_back(std::make_unique<Worker>(this));
         }
+        events_ = std::make_unique<Events>(handle_);
+        pool_ = std::make_unique<ThreadPool>(options_.threads);
     }
 
     for (std::uint32_t retry = options_.retry; !chunks.empty() && retry; --retry) {
@@ -223,6 +435,7 @@ auto RCDN::get(std::vector<RChunk::Dst> chunks, RChunk::Dst::data_cb on_data) ->
         auto chunks_failed = std::vector<RChunk::Dst>{};
         chunks_failed.reserve(chunks.size());
         auto chunks_queue = std::span<RChunk::Dst const>(chunks);
+        auto decoder = Decoder(this, pool_.get(), on_data);
         auto workers_free = std::vector<Worker*>{};
         for (auto const& worker : workers_) {
             workers_free.push_back(worker.get());
@@ -232,7 +445,7 @@ auto RCDN::get(std::vector<RChunk::Dst> chunks, RChunk::Dst::data_cb on_data) ->
             // Start new downloads
             while (!workers_free.empty() && !chunks_queue.empty()) {
                 auto worker = workers_free.back();
-                auto handle = worker->start(chunks_queue, on_data);
+                auto handle = worker->start(chunks_queue, &decoder);
                 workers_free.pop_back();
                 ++workers_running;
                 rlib_assert_multi_curl(curl_multi_add_handle(handle_, handle));
@@ -243,10 +456,8 @@ auto RCDN::get(std::vector<RChunk::Dst> chunks, RChunk::Dst::data_cb on_data) ->
                 break;
             }
 
-            // Perform any actual work.
-            // NOTE: i do not trust still_running out variable, do our own bookkeeping instead.
-            int still_running = 0;
-            rlib_assert_multi_curl(curl_multi_perform(handle_, &still_running));
+            // Wait for and perform any actual work.
+            events_->perform(options_.interval);
 
             // Process messages.
             for (int msg_left = 0; auto msg = curl_multi_info_read(handle_, &msg_left);) {
@@ -256,21 +467,73 @@ auto RCDN::get(std::vector<RChunk::Dst> chunks, RChunk::Dst::data_cb on_data) ->
                 auto worker = (Worker*)nullptr;
                 curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &worker);
                 rlib_assert(worker);
-                auto handle = worker->finish(chunks_failed);
+                auto handle = worker->finish(chunks_failed, stats_);
                 workers_free.push_back(worker);
                 --workers_running;
                 rlib_assert_multi_curl(curl_multi_remove_handle(handle_, handle));
             }
-
-            // Block untill end.
-            rlib_assert_multi_curl(curl_multi_wait(handle_, nullptr, 0, options_.interval, nullptr));
         }
 
+        decoder.finish(chunks_failed, stats_);
         chunks = std::move(chunks_failed);
     }
     return chunks;
 }
 
+auto RCDN::decompress_internal(RChunk::Src const& chunk, std::span<char const> src) const -> std::span<char const> {
+    src = src.subspan(0, chunk.compressed_size);
+    auto compressed_size = rlib_assert_zstd(ZSTD_findFrameCompressedSize(src.data(), src.size()));
+    rlib_assert(compressed_size == chunk.compressed_size);
+    if (auto const dict_id = (std::uint32_t)ZSTD_getDictID_fromFrame(src.data(), src.size())) {
+        if (!zstd_dict_contains(dict_id)) {
+            this->load_dict_internal(chunk.bundleId, dict_id);
+        }
+    }
+    auto dst = zstd_decompress(src, chunk.uncompressed_size);
+    if (cache_ && cache_->can_write()) {
+        cache_->add(chunk, src);
+    }
+    return dst;
+}
+
+auto RCDN::load_dict_internal(BundleID bundleId, std::uint32_t dict_id) const -> void {
+    std::lock_guard lock(dict_mutex_);
+    if (zstd_dict_contains(dict_id)) {
+        return;
+    }
+    rlib_trace("bundleId: %016llX, dict_id: %08x", (unsigned long long)bundleId, dict_id);
+    if (!dict_worker_) {
+        dict_worker_ = std::make_unique<Worker>(this);
+    }
+    // bundles that use dictionary carry their own copy of it, it is found through toc at end of bundle
+    auto footer = RBUN::Footer{};
+    auto const footer_data = dict_worker_->get_range(bundleId, fmt::format("-{}", sizeof(footer)));
+    rlib_assert(footer_data.size() == sizeof(footer));
+    std::memcpy(&footer, footer_data.data(), sizeof(footer));
+    rlib_assert(footer.magic == RBUN::Footer::MAGIC);
+    auto const toc_size = sizeof(RChunk) * footer.entry_count;
+    auto const toc_data = dict_worker_->get_range(bundleId, fmt::format("-{}", toc_size + sizeof(footer)));
+    rlib_assert(toc_data.size() == toc_size + sizeof(footer));
+    auto toc = std::vector<RChunk>(footer.entry_count);
+    std::memcpy(toc.data(), toc_data.data(), toc_size);
+    auto const chunkId = RChunk::dict_chunk_id(dict_id);
+    auto compressed_offset = std::uint64_t{};
+    auto i = toc.begin();
+    for (; i != toc.end() && i->chunkId != chunkId; ++i) {
+        compressed_offset += i->compressed_size;
+    }
+    rlib_assert(i != toc.end());
+    auto const range = fmt::format("{}-{}", compressed_offset, compressed_offset + i->compressed_size - 1);
+    auto const compressed = dict_worker_->get_range(bundleId, range);
+    rlib_assert(compressed.size() == i->compressed_size);
+    auto const dict = zstd_decompress(compressed, i->uncompressed_size);
+    rlib_assert(RChunk::hash(dict, HashType::ZSTD_DICT) == chunkId);
+    zstd_dict_add(dict);
+    if (cache_ && cache_->can_write()) {
+        cache_->add(*i, compressed);
+    }
+}
+
 auto RCDN::get_into(RChunk::Src const& src, std::span<char> dst) -> bool {
     // FIXME: we are only allowed one RCDN per whole program
     thread_local std::unique_ptr<Worker> one_ = {};
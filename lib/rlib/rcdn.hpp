@@ -1,7 +1,9 @@
 #pragma once
+#include <array>
 #include <functional>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <span>
 #include <string>
@@ -10,6 +12,7 @@
 #include "common.hpp"
 #include "rcache.hpp"
 #include "rchunk.hpp"
+#include "threadpool.hpp"
 
 namespace rlib {
     struct RCDN {
@@ -26,6 +29,18 @@ namespace rlib {
             std::string cookielist = {};
             std::size_t low_speed_limit = 64 * KiB;
             std::size_t low_speed_time = 0;
+            std::size_t merge_gap = 0;
+            std::size_t max_range = 0;
+            std::uint32_t threads = 1;
+        };
+
+        struct Stats {
+            // Request count by latency, bucket N holds requests that took [2^(N-1), 2^N) miliseconds.
+            std::array<std::uint64_t, 20> latency = {};
+            std::uint64_t requests = {};
+            std::uint64_t failed = {};
+            // Why last chunk failed to be received or decoded, empty when none did.
+            std::string error = {};
         };
 
         RCDN(Options const& options, RCache* cache_out);
@@ -36,11 +51,25 @@ namespace rlib {
 
         auto get_into(RChunk::Src const& src, std::span<char> dst) -> bool;
 
+        auto stats() const noexcept -> Stats const& { return stats_; }
+
     private:
         struct Worker;
+        struct Decoder;
+        struct Events;
         Options options_;
         RCache* cache_;
         mutable void* handle_;
         mutable std::vector<std::unique_ptr<Worker>> workers_;
+        std::unique_ptr<Events> events_;
+        std::unique_ptr<ThreadPool> pool_;
+        Stats stats_;
+        mutable std::mutex dict_mutex_;
+        mutable std::unique_ptr<Worker> dict_worker_;
+
+        auto decompress_internal(RChunk::Src const& chunk, std::span<char const> src) const -> std::span<char const>;
+
+        // Fetches bundle toc and dictionary chunk it holds, each dictionary is fetched once per process.
+        auto load_dict_internal(BundleID bundleId, std::uint32_t dict_id) const -> void;
     };
 }
\ No newline at end of file
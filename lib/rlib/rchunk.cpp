@@ -1,17 +1,21 @@
 #include "rchunk.hpp"
 
+#include <zstd.h>
+
 #include <bit>
 #include <cstring>
 #include <digestpp.hpp>
 
+#include "buffer.hpp"
 #include "common.hpp"
 #include "iofile.hpp"
+#include "sha256.hpp"
+#include "threadpool.hpp"
 #include "blake3.h"
 
 using namespace rlib;
 
 auto RChunk::hkdf(std::array<std::uint8_t, 64> const& src) noexcept -> ChunkID {
-    using digestpp::sha256;
     auto ipad = src;
     for (auto& p : ipad) {
         p ^= 0x36u;
@@ -20,14 +24,18 @@ auto RChunk::hkdf(std::array<std::uint8_t, 64> const& src) noexcept -> ChunkID {
     for (auto& p : opad) {
         p ^= 0x5Cu;
     }
-    auto tmp = std::array<std::uint8_t, 32>{};
-    sha256().absorb(ipad.data(), ipad.size()).absorb("\0\0\0\1", 4).digest(tmp.data(), 32);
-    sha256().absorb(opad.data(), opad.size()).absorb(tmp.data(), tmp.size()).digest(tmp.data(), 32);
+    // key blocks are same for every round, absorb them once and copy hasher
+    auto inner = SHA256{};
+    inner.absorb(ipad.data(), ipad.size());
+    auto outer = SHA256{};
+    outer.absorb(opad.data(), opad.size());
+    auto tmp = SHA256(inner).absorb("\0\0\0\1", 4).digest();
+    tmp = SHA256(outer).absorb(tmp.data(), tmp.size()).digest();
     auto result = std::array<std::uint8_t, 8>{};
     std::memcpy(&result, tmp.data(), 8);
     for (std::uint32_t rounds = 31; rounds; rounds--) {
-        sha256().absorb(ipad.data(), ipad.size()).absorb(tmp.data(), tmp.size()).digest(tmp.data(), 32);
-        sha256().absorb(opad.data(), opad.size()).absorb(tmp.data(), tmp.size()).digest(tmp.data(), 32);
+        tmp = SHA256(inner).absorb(tmp.data(), tmp.size()).digest();
+        tmp = SHA256(outer).absorb(tmp.data(), tmp.size()).digest();
         for (std::size_t i = 0; i != 8; ++i) {
             result[i] ^= tmp[i];
         }
@@ -35,8 +43,72 @@ auto RChunk::hkdf(std::array<std::uint8_t, 64> const& src) noexcept -> ChunkID {
     return std::bit_cast<ChunkID>(result);
 }
 
+// Turns state into digest placed in front of single block message that follows 64 byte key block.
+static auto hkdf_message(SHA256::Block& block, std::uint8_t const* data, std::size_t size) noexcept -> void {
+    auto const bits = (64 + size) * 8;
+    block = {};
+    std::memcpy(block.data(), data, size);
+    block[size] = 0x80;
+    block[62] = (std::uint8_t)(bits >> 8);
+    block[63] = (std::uint8_t)bits;
+}
+
+static auto hkdf_digest(SHA256::Block& block, SHA256::State const& state) noexcept -> void {
+    auto digest = SHA256::Digest{};
+    for (std::size_t i = 0; i != 8; ++i) {
+        digest[i * 4 + 0] = (std::uint8_t)(state[i] >> 24);
+        digest[i * 4 + 1] = (std::uint8_t)(state[i] >> 16);
+        digest[i * 4 + 2] = (std::uint8_t)(state[i] >> 8);
+        digest[i * 4 + 3] = (std::uint8_t)(state[i]);
+    }
+    hkdf_message(block, digest.data(), digest.size());
+}
+
+static auto hkdf_many(std::span<SHA256::Block const> keys, std::span<ChunkID> ids) -> void {
+    auto const count = keys.size();
+    auto inner = std::vector<SHA256::State>(count, SHA256::INIT);
+    auto outer = std::vector<SHA256::State>(count, SHA256::INIT);
+    auto states = std::vector<SHA256::State>(count);
+    auto blocks = std::vector<SHA256::Block>(count);
+    auto results = std::vector<std::array<std::uint8_t, 8>>(count);
+    // key blocks are same for every round, compress them once
+    for (auto [pad, key_states] : {std::pair{0x36u, &inner}, std::pair{0x5Cu, &outer}}) {
+        for (std::size_t i = 0; i != count; ++i) {
+            for (std::size_t j = 0; j != 64; ++j) {
+                blocks[i][j] = keys[i][j] ^ pad;
+            }
+        }
+        SHA256::compress_lanes(*key_states, blocks);
+    }
+    for (auto& block : blocks) {
+        hkdf_message(block, (std::uint8_t const*)"\0\0\0\1", 4);
+    }
+    for (std::uint32_t rounds = 32; rounds; rounds--) {
+        states = inner;
+        SHA256::compress_lanes(states, blocks);
+        for (std::size_t i = 0; i != count; ++i) {
+            hkdf_digest(blocks[i], states[i]);
+        }
+        states = outer;
+        SHA256::compress_lanes(states, blocks);
+        for (std::size_t i = 0; i != count; ++i) {
+            hkdf_digest(blocks[i], states[i]);
+            for (std::size_t j = 0; j != 8; ++j) {
+                results[i][j] ^= blocks[i][j];
+            }
+        }
+    }
+    for (std::size_t i = 0; i != count; ++i) {
+        ids[i] = std::bit_cast<ChunkID>(results[i]);
+    }
+}
+
+auto RChunk::dict_chunk_id(std::uint32_t dict_id) noexcept -> ChunkID {
+    // top half is dictionary magic, hashes of regular chunks are very unlikely to collide with it
+    return (ChunkID)(((std::uint64_t)ZSTD_MAGIC_DICTIONARY << 32) | dict_id);
+}
+
 auto RChunk::hash(std::span<char const> data, HashType type) noexcept -> ChunkID {
-    using digestpp::sha256;
     using digestpp::sha512;
     switch (type) {
         case HashType::None:
@@ -47,13 +119,13 @@ auto RChunk::hash(std::span<char const> data, HashType type) noexcept -> ChunkID
             return std::bit_cast<ChunkID>(to_array<std::uint8_t, 8>(buffer));
         }
         case HashType::SHA256: {
-            auto buffer = std::array<std::uint8_t, 64>{};
-            sha256().absorb((std::uint8_t const*)data.data(), data.size()).digest(buffer.data(), 32);
-            return std::bit_cast<ChunkID>(to_array<std::uint8_t, 8>(buffer));
+            auto const digest = SHA256().absorb(data.data(), data.size()).digest();
+            return std::bit_cast<ChunkID>(to_array<std::uint8_t, 8>(digest));
         }
         case HashType::RITO_HKDF: {
             auto buffer = std::array<std::uint8_t, 64>{};
-            sha256().absorb((std::uint8_t const*)data.data(), data.size()).digest(buffer.data(), 32);
+            auto const digest = SHA256().absorb(data.data(), data.size()).digest();
+            std::memcpy(buffer.data(), digest.data(), digest.size());
             return hkdf(buffer);
         }
         case HashType::BLAKE3: {
@@ -64,17 +136,44 @@ auto RChunk::hash(std::span<char const> data, HashType type) noexcept -> ChunkID
             blake3_hasher_finalize(&hasher, buffer.data(), buffer.size());
             return std::bit_cast<ChunkID>(buffer);
         }
+        case HashType::ZSTD_DICT: {
+            auto const dict_id = (std::uint32_t)ZSTD_getDictID_fromDict(data.data(), data.size());
+            return dict_id ? dict_chunk_id(dict_id) : ChunkID::None;
+        }
         default:
             return {};
     }
 }
 
-auto RChunk::hash_type(std::span<char const> data, ChunkID chunkId) -> HashType {
-    using digestpp::sha256;
+auto RChunk::hash_many(std::span<std::span<char const> const> datas, HashType type) -> std::vector<ChunkID> {
+    auto result = std::vector<ChunkID>(datas.size());
+    if (type != HashType::RITO_HKDF) {
+        std::transform(datas.begin(), datas.end(), result.begin(), [type](auto data) { return hash(data, type); });
+        return result;
+    }
+    auto keys = std::vector<SHA256::Block>(datas.size());
+    for (std::size_t i = 0; i != datas.size(); ++i) {
+        auto const digest = SHA256().absorb(datas[i].data(), datas[i].size()).digest();
+        std::memcpy(keys[i].data(), digest.data(), digest.size());
+    }
+    hkdf_many(keys, result);
+    return result;
+}
+
+auto RChunk::hash_type(std::span<char const> data, ChunkID chunkId, HashType hint) -> HashType {
     using digestpp::sha512;
 
+    if (hint != HashType::None && RChunk::hash(data, hint) == chunkId) {
+        return hint;
+    }
+
+    if (dict_chunk_id((std::uint32_t)chunkId) == chunkId && RChunk::hash(data, HashType::ZSTD_DICT) == chunkId) {
+        return HashType::ZSTD_DICT;
+    }
+
     auto buffer = std::array<std::uint8_t, 64>{};
-    sha256().absorb((std::uint8_t const*)data.data(), data.size()).digest(buffer.data(), 32);
+    auto const digest = SHA256().absorb(data.data(), data.size()).digest();
+    std::memcpy(buffer.data(), digest.data(), digest.size());
     if (std::memcmp(buffer.data(), &chunkId, 8) == 0) {
         return HashType::SHA256;
     }
@@ -95,25 +194,98 @@ auto RChunk::hash_type(std::span<char const> data, ChunkID chunkId) -> HashType
     return HashType::None;
 }
 
-auto RChunk::Dst::verify(fs::path const& path, std::vector<RChunk::Dst>& chunks, data_cb on_good) -> void {
+auto RChunk::hash_type_parse(std::string_view name) -> HashType {
+    if (name.empty() || name == "auto") return HashType::None;
+    if (name == "sha512") return HashType::SHA512;
+    if (name == "sha256") return HashType::SHA256;
+    if (name == "hkdf") return HashType::RITO_HKDF;
+    if (name == "blake3") return HashType::BLAKE3;
+    rlib_error(fmt::format("Unknown hash type: {}", name).c_str());
+}
+
+auto RChunk::Dst::verify(fs::path const& path, std::vector<RChunk::Dst>& chunks, data_cb on_good, ThreadPool* pool)
+    -> void {
+    static constexpr std::size_t VERIFY_GROUP = 16;
     if (!fs::exists(path)) {
         return;
     }
-    auto infile = IO::File(path, IO::READ);
-    remove_if(chunks, [&, failfast = false](RChunk::Dst const& chunk) mutable -> bool {
-        if (failfast) {
-            return false;
+    auto const batch_size = 32 * MiB;
+    auto infile = IO::File(path, IO::READ | IO::SEQUENTIAL);
+    auto buffer = Buffer{};
+    auto ops = std::vector<IO::ReadOp>{};
+    auto ids = std::vector<ChunkID>{};
+    auto bad = std::vector<RChunk::Dst>{};
+    auto index = std::size_t{};
+    while (index != chunks.size()) {
+        auto const next = std::span(chunks).subspan(index);
+        auto count = std::size_t{};
+        auto total = std::size_t{};
+        for (; count != next.size(); ++count) {
+            if (!in_range(next[count].uncompressed_offset, next[count].uncompressed_size, infile.size())) {
+                break;
+            }
+            if (count && total + next[count].uncompressed_size > batch_size) {
+                break;
+            }
+            total += next[count].uncompressed_size;
         }
-        if (!in_range(chunk.uncompressed_offset, chunk.uncompressed_size, infile.size())) {
-            failfast = true;
-            return false;
+        // chunk out of file bounds or failed read stops verification, everything left is bad
+        if (!count || !buffer.resize_destroy(total)) {
+            break;
         }
-        auto data = infile.copy(chunk.uncompressed_offset, chunk.uncompressed_size);
-        auto id = RChunk::hash(data, chunk.hash_type);
-        if (id == chunk.chunkId) {
-            on_good(chunk, data);
-            return true;
+        ops.clear();
+        for (auto pos = std::size_t{}; auto const& c : next.subspan(0, count)) {
+            ops.push_back({c.uncompressed_offset, buffer.subspan(pos, c.uncompressed_size)});
+            pos += c.uncompressed_size;
         }
-        return false;
-    });
+        if (!infile.read_batch(ops)) {
+            break;
+        }
+        // hash groups of batch side by side, results are still reported in chunk order
+        ids.resize(count);
+        auto const hash_group = [&, next](std::size_t start) {
+            auto const group = next.subspan(start, std::min(count - start, VERIFY_GROUP));
+            auto const hash_type = group[0].hash_type;
+            auto const same_hash = [&](RChunk::Dst const& c) { return c.hash_type == hash_type; };
+            if (std::all_of(group.begin(), group.end(), same_hash)) {
+                auto datas = std::vector<std::span<char const>>(group.size());
+                for (std::size_t n = 0; n != group.size(); ++n) {
+                    datas[n] = ops[start + n].dst;
+                }
+                auto const result = RChunk::hash_many(datas, hash_type);
+                std::copy(result.begin(), result.end(), ids.begin() + start);
+            } else {
+                for (std::size_t n = 0; n != group.size(); ++n) {
+                    ids[start + n] = RChunk::hash(ops[start + n].dst, group[n].hash_type);
+                }
+            }
+        };
+        if (pool && pool->size() > 1 && count > VERIFY_GROUP) {
+            auto results = std::vector<std::future<void>>{};
+            for (std::size_t start = 0; start < count; start += VERIFY_GROUP) {
+                results.push_back(pool->submit([&hash_group, start] { hash_group(start); }));
+            }
+            // every task references this batch, let all of them finish before rethrowing
+            for (auto& result : results) {
+                result.wait();
+            }
+            for (auto& result : results) {
+                result.get();
+            }
+        } else {
+            for (std::size_t start = 0; start < count; start += VERIFY_GROUP) {
+                hash_group(start);
+            }
+        }
+        for (std::size_t n = 0; n != count; ++n) {
+            if (ids[n] == next[n].chunkId) {
+                on_good(next[n], ops[n].dst);
+            } else {
+                bad.push_back(next[n]);
+            }
+        }
+        index += count;
+    }
+    bad.insert(bad.end(), chunks.begin() + index, chunks.end());
+    chunks = std::move(bad);
 }
\ No newline at end of file
@@ -3,10 +3,13 @@
 #include <cstddef>
 #include <cstdint>
 #include <span>
+#include <string_view>
 
 #include "common.hpp"
 
 namespace rlib {
+    struct ThreadPool;
+
     enum class BundleID : std::uint64_t { None };
 
     enum class ChunkID : std::uint64_t { None };
@@ -17,6 +20,8 @@ namespace rlib {
         SHA256,
         RITO_HKDF,
         BLAKE3,
+        // Only used in bundles, chunk holds zstd dictionary and is keyed by its dictionary id.
+        ZSTD_DICT,
     };
 
     struct RChunk {
@@ -27,8 +32,15 @@ namespace rlib {
         std::uint32_t compressed_size;
 
         static auto hash(std::span<char const> data, HashType type) noexcept -> ChunkID;
-        static auto hash_type(std::span<char const> data, ChunkID chunkId) -> HashType;
+        // Same as hash for every data, RITO_HKDF rounds of different chunks run side by side.
+        static auto hash_many(std::span<std::span<char const> const> datas, HashType type) -> std::vector<ChunkID>;
+        // Hint is checked first so known hash type costs single hash, others are only tried on mismatch.
+        static auto hash_type(std::span<char const> data, ChunkID chunkId, HashType hint = HashType::None)
+            -> HashType;
+        // Accepts "auto" (None), "sha512", "sha256", "hkdf" and "blake3".
+        static auto hash_type_parse(std::string_view name) -> HashType;
         static auto hkdf(std::array<std::uint8_t, 64> const& src) noexcept -> ChunkID;
+        static auto dict_chunk_id(std::uint32_t dict_id) noexcept -> ChunkID;
 
         struct Src;
         struct Dst;
@@ -45,7 +57,12 @@ namespace rlib {
         std::uint64_t uncompressed_offset;
         using data_cb = function_ref<void(RChunk::Dst const& chunk, std::span<char const> data)>;
 
-        static auto verify(fs::path const& path, std::vector<RChunk::Dst>& chunks, data_cb on_good) -> void;
+        // Removes chunks that already match, stops at first chunk out of file bounds.
+        // Pool hashes chunks of each read batch in parallel, on_good is still called in order on calling thread.
+        static auto verify(fs::path const& path,
+                           std::vector<RChunk::Dst>& chunks,
+                           data_cb on_good,
+                           ThreadPool* pool = nullptr) -> void;
 
         struct Packed;
     };
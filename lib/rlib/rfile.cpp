@@ -4,10 +4,15 @@
 #include <zstd.h>
 
 #include <charconv>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <shared_mutex>
 
 #include "common.hpp"
 #include "iofile.hpp"
 #include "rmanifest.hpp"
+#include "threadpool.hpp"
 
 using namespace rlib;
 
@@ -63,6 +68,103 @@ namespace JS {
 
     template <>
     struct TypeHandler<ChunkID> : TypeHandlerHex<ChunkID> {};
+
+    template <>
+    struct TypeHandler<Langs> {
+        static inline Error to(Langs& to_type, ParseContext& context) {
+            auto names = std::string{};
+            auto error = TypeHandler<std::string>::to(names, context);
+            if (error == Error::NoError) {
+                to_type = Langs::parse(names);
+            }
+            return error;
+        }
+
+        static void from(Langs const& from_type, Token& token, Serializer& serializer) {
+            auto const names = from_type.names();
+            TypeHandler<std::string>::from(names, token, serializer);
+        }
+    };
+}
+
+namespace {
+    // Names are only ever appended so bit given to language stays valid for whole process.
+    struct LangTable {
+        std::shared_mutex mutex;
+        std::vector<std::string> names;
+    };
+
+    auto lang_table() -> LangTable& {
+        static auto instance = LangTable{};
+        return instance;
+    }
+}
+
+auto Langs::bit(std::string_view name) -> std::uint64_t {
+    auto& table = lang_table();
+    auto const find = [&] { return std::find(table.names.begin(), table.names.end(), name) - table.names.begin(); };
+    {
+        std::shared_lock lock(table.mutex);
+        if (auto const index = find(); index != (std::ptrdiff_t)table.names.size()) {
+            return 1ull << index;
+        }
+    }
+    std::unique_lock lock(table.mutex);
+    if (auto const index = find(); index != (std::ptrdiff_t)table.names.size()) {
+        return 1ull << index;
+    }
+    rlib_assert(table.names.size() < 64);
+    table.names.emplace_back(name);
+    return 1ull << (table.names.size() - 1);
+}
+
+auto Langs::parse(std::string_view names) -> Langs {
+    auto result = Langs{};
+    while (!names.empty()) {
+        auto [name, rest] = str_split(names, ';');
+        name = str_strip(name);
+        if (!name.empty() && name != "none") {
+            result.mask |= Langs::bit(name);
+        }
+        names = rest;
+    }
+    return result;
+}
+
+auto Langs::search(Pattern const& pattern) -> Langs {
+    auto& table = lang_table();
+    std::shared_lock lock(table.mutex);
+    auto result = Langs{};
+    for (std::size_t i = 0; i != table.names.size(); ++i) {
+        if (pattern(table.names[i])) {
+            result.mask |= 1ull << i;
+        }
+    }
+    return result;
+}
+
+auto Langs::known() noexcept -> std::size_t {
+    auto& table = lang_table();
+    std::shared_lock lock(table.mutex);
+    return table.names.size();
+}
+
+auto Langs::names() const -> std::string {
+    if (!mask) {
+        return "none";
+    }
+    auto& table = lang_table();
+    std::shared_lock lock(table.mutex);
+    auto result = std::string{};
+    for (std::size_t i = 0; i != table.names.size(); ++i) {
+        if (mask & (1ull << i)) {
+            if (!result.empty()) {
+                result += ';';
+            }
+            result += table.names[i];
+        }
+    }
+    return result;
 }
 
 /* clang-format off */
@@ -71,10 +173,20 @@ JS_OBJ_EXT(rlib::RFile, chunks, fileId, langs, link, path, permissions, size, ti
 /* clang-format on */
 
 auto RFile::Match::operator()(RFile const& file) const noexcept -> bool {
-    if (langs && !std::regex_search(file.langs, *langs)) {
-        return false;
+    if (langs) {
+        // file without languages is matched against "none" same as before languages were bits
+        if (!langs_none_) {
+            langs_none_ = (*langs)("none");
+        }
+        if (auto const known = Langs::known(); known != langs_known_) {
+            langs_mask_ = Langs::search(*langs).mask;
+            langs_known_ = known;
+        }
+        if (file.langs.mask ? !(file.langs.mask & langs_mask_) : !*langs_none_) {
+            return false;
+        }
     }
-    if (path && !std::regex_search(file.path, *path)) {
+    if (path && !(*path)(file.path)) {
         return false;
     }
     return true;
@@ -151,7 +263,7 @@ auto RFile::read_zrman(std::span<char const> data, read_cb cb) -> void {
     }
 }
 
-auto RFile::read(std::span<char const> data, read_cb cb) -> void {
+auto RFile::read(std::span<char const> data, read_cb cb, std::uint32_t threads) -> void {
     rlib_assert(data.size() >= 5);
     if (std::memcmp(data.data(), "JRMAN", 5) == 0) {
         read_jrman(data, cb);
@@ -161,18 +273,68 @@ auto RFile::read(std::span<char const> data, read_cb cb) -> void {
         read_zrman(data, cb);
         return;
     }
-    auto rman = RMAN::read(data);
-    for (auto& rfile : rman.files) {
-        if (!cb(rfile)) {
-            break;
+    // files are decoded in blocks that get reused, listing does not allocate unless callback keeps files
+    auto const BLOCK_FILES = std::size_t{16384};
+    auto rman = RMAN::View(data, threads);
+    auto block = std::vector<RFile>(std::min(rman.size(), BLOCK_FILES));
+    for (std::size_t start = 0; start != rman.size();) {
+        auto const files = std::span(block).first(std::min(block.size(), rman.size() - start));
+        rman.read(start, files);
+        for (auto& rfile : files) {
+            if (!cb(rfile)) {
+                return;
+            }
         }
+        start += files.size();
     }
 }
 
-auto RFile::read_file(fs::path const& path, read_cb cb) -> void {
+auto RFile::read_file(fs::path const& path, read_cb cb, std::uint32_t threads) -> void {
     auto infile = IO::MMap(path, IO::READ);
     auto data = infile.copy(0, infile.size());
-    return RFile::read(data, cb);
+    return RFile::read(data, cb, threads);
+}
+
+auto RFile::read_files(std::vector<fs::path> const& paths, read_files_cb cb) -> void {
+    // keep only few manifests in memory and split cores between ones being parsed
+    auto pool = ThreadPool((std::uint32_t)std::min<std::size_t>(paths.size(), 4));
+    auto const threads = std::max(ThreadPool::hardware_threads() / std::max(pool.size(), 1u), 1u);
+    auto pending = std::deque<std::future<std::vector<RFile>>>{};
+    auto next = paths.begin();
+    for (auto const& path : paths) {
+        for (; next != paths.end() && pending.size() <= pool.size(); ++next) {
+            pending.push_back(pool.submit([&path = *next, threads] {
+                auto files = std::vector<RFile>{};
+                RFile::read_file(
+                    path,
+                    [&](RFile& rfile) {
+                        files.push_back(std::move(rfile));
+                        return true;
+                    },
+                    threads);
+                return files;
+            }));
+        }
+        auto files = pending.front().get();
+        pending.pop_front();
+        cb(path, files);
+    }
+}
+
+auto RFile::read_hash_types(fs::path const& path) -> std::unordered_map<ChunkID, HashType> {
+    rlib_trace("path: %s", path.generic_string().c_str());
+    auto result = std::unordered_map<ChunkID, HashType>{};
+    RFile::read_file(path, [&](RFile& rfile) {
+        if (rfile.chunks) {
+            for (auto const& chunk : *rfile.chunks) {
+                if (chunk.hash_type != HashType::None) {
+                    result.emplace(chunk.chunkId, chunk.hash_type);
+                }
+            }
+        }
+        return true;
+    });
+    return result;
 }
 
 auto RFile::has_known_bundle(fs::path const& path) -> bool {
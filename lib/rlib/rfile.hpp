@@ -3,11 +3,13 @@
 #include <cstddef>
 #include <filesystem>
 #include <optional>
-#include <regex>
 #include <span>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include "pattern.hpp"
 #include "rchunk.hpp"
 
 namespace rlib {
@@ -15,30 +17,62 @@ namespace rlib {
 
     enum class FileID : std::uint64_t { None };
 
+    // Languages as bitmask, bit n stands for n-th name of table shared by every loaded manifest.
+    struct Langs {
+        std::uint64_t mask;
+
+        // Bit of language name, new names are appended to shared table.
+        static auto bit(std::string_view name) -> std::uint64_t;
+        // Parses ';' separated names, "none" or empty string has no languages.
+        static auto parse(std::string_view names) -> Langs;
+        // Every known language with name that matches pattern.
+        static auto search(Pattern const& pattern) -> Langs;
+        // Number of names in shared table, grows as manifests with new languages are read.
+        static auto known() noexcept -> std::size_t;
+
+        // Joins names with ';' or gives "none".
+        auto names() const -> std::string;
+
+        auto operator==(Langs const& other) const noexcept -> bool = default;
+    };
+
     struct RFile {
         FileID fileId;
         std::uint8_t permissions;
         std::uint64_t size;
         std::string path;
         std::string link;
-        std::string langs;
+        Langs langs;
         std::uint64_t time;
         std::optional<std::vector<RChunk::Dst>> chunks;
 
         struct Match {
-            std::optional<std::regex> path;
-            std::optional<std::regex> langs;
+            std::optional<Pattern> path;
+            std::optional<Pattern> langs;
 
             auto operator()(RFile const& file) const noexcept -> bool;
+
+        private:
+            // langs pattern compiled to mask of matching names, redone when shared table grows
+            mutable std::uint64_t langs_mask_ = {};
+            mutable std::size_t langs_known_ = {};
+            mutable std::optional<bool> langs_none_ = {};
         };
 
         using read_cb = function_ref<bool(RFile&)>;
+        using read_files_cb = function_ref<void(fs::path const& path, std::vector<RFile>& files)>;
 
         auto dump() const -> std::string;
 
         static auto undump(std::string_view data) -> RFile;
-        static auto read(std::span<char const> data, read_cb cb) -> void;
-        static auto read_file(fs::path const& path, read_cb cb) -> void;
+        // 0 threads decodes binary manifests on all cores.
+        static auto read(std::span<char const> data, read_cb cb, std::uint32_t threads = 0) -> void;
+        static auto read_file(fs::path const& path, read_cb cb, std::uint32_t threads = 0) -> void;
+        // Parses several manifests at once, cb still gets them one at time in order of paths.
+        static auto read_files(std::vector<fs::path> const& paths, read_files_cb cb) -> void;
+
+        // Hash type of every chunk referenced by manifest, lets bundle tools hash each chunk once.
+        static auto read_hash_types(fs::path const& path) -> std::unordered_map<ChunkID, HashType>;
 
         static auto writer(fs::path const& out, bool append = false) -> std::function<void(RFile&&)>;
 
@@ -50,6 +84,14 @@ namespace rlib {
     };
 }
 
+template <>
+struct fmt::formatter<rlib::Langs> : formatter<std::string> {
+    template <typename FormatContext>
+    auto format(rlib::Langs langs, FormatContext& ctx) {
+        return formatter<std::string>::format(langs.names(), ctx);
+    }
+};
+
 template <>
 struct fmt::formatter<rlib::FileID> : formatter<std::string> {
     template <typename FormatContext>
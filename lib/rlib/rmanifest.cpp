@@ -2,6 +2,7 @@
 
 #include <zstd.h>
 
+#include <array>
 #include <cstring>
 #include <limits>
 #include <regex>
@@ -10,8 +11,11 @@
 #include <unordered_map>
 #include <unordered_set>
 
+#include "buffer.hpp"
+#include "chunkindex.hpp"
 #include "common.hpp"
 #include "iofile.hpp"
+#include "threadpool.hpp"
 
 using namespace rlib;
 
@@ -32,15 +36,19 @@ struct RMAN::Raw {
         inline bool operator!() const noexcept { return !operator bool(); }
     };
 
+    // Points at vtable inside body instead of copying it, so decoding table does not allocate.
     struct Table {
         Offset beg = {};
         std::int32_t vtable_size = {};
         std::int32_t struct_size = {};
-        std::vector<std::uint16_t> offsets = {};
+        char const* offsets = {};
 
         inline Offset operator[](std::size_t index) const {
             rlib_assert(beg);
-            auto voffset = index < offsets.size() ? offsets[index] : 0;
+            auto voffset = std::uint16_t{};
+            if (index < (std::size_t)(vtable_size - 4) / 2) {
+                memcpy(&voffset, offsets + index * 2, sizeof(voffset));
+            }
             auto result = beg;
             if (voffset) {
                 result.cur += voffset;
@@ -93,6 +101,34 @@ struct RMAN::Raw {
         memcpy(value.data(), offset.beg + offset.cur, (std::size_t)size);
     }
 
+    static inline void from_offset(Offset offset, std::string_view& value) {
+        offset = offset.as<Offset>();
+        if (!offset) {
+            return;
+        }
+        auto size = offset.as<std::int32_t>();
+        if (!size) {
+            return;
+        }
+        rlib_assert(size >= 0 && size <= 4096);
+        offset.cur += sizeof(std::int32_t);
+        rlib_assert(offset.cur + size <= offset.end);
+        value = std::string_view(offset.beg + offset.cur, (std::size_t)size);
+    }
+
+    // Raw bytes of vector with fixed size elements.
+    static inline auto vector_bytes(Offset offset, std::size_t element_size) -> std::span<char const> {
+        offset = offset.as<Offset>();
+        if (!offset) {
+            return {};
+        }
+        auto size = offset.as<std::int32_t>();
+        rlib_assert(size >= 0);
+        offset.cur += sizeof(std::int32_t);
+        rlib_assert(offset.cur + (std::int64_t)size * (std::int64_t)element_size <= offset.end);
+        return {offset.beg + offset.cur, (std::size_t)size * element_size};
+    }
+
     static inline void from_offset(Offset offset, Table& value) {
         offset = offset.as<Offset>();
         rlib_assert(offset);
@@ -106,9 +142,7 @@ struct RMAN::Raw {
         offset.cur += sizeof(std::uint16_t);
         value.struct_size = offset.as<std::uint16_t>();
         offset.cur += sizeof(std::uint16_t);
-        auto members_size = value.vtable_size - 4;
-        value.offsets.resize(members_size / 2);
-        memcpy(value.offsets.data(), offset.beg + offset.cur, members_size);
+        value.offsets = offset.beg + offset.cur;
     }
 
     template <typename T>
@@ -169,17 +203,22 @@ struct RMAN::Raw {
         std::uint32_t body_length;
         char reserved[4];
     } header;
-    std::unordered_map<std::uint8_t, std::string> lookup_lang_name;
+    Buffer body;
+    std::array<std::uint64_t, 32> lookup_lang_bit = {};
     std::unordered_map<std::uint64_t, std::string> lookup_dir_name;
     std::unordered_map<std::uint64_t, std::uint64_t> lookup_dir_parent;
+    std::unordered_map<std::uint64_t, std::string> lookup_dir_path;
     std::unordered_map<std::size_t, Params> lookup_params;
-    std::unordered_map<ChunkID, RChunk::Src> lookup_chunk;
+    ChunkIndex lookup_chunk;
     std::vector<RBUN> bundles;
-    std::vector<RFile> files;
+    Offset file_tables = {};
+    std::size_t file_count = {};
 
-    auto parse(std::span<char const> src) && -> RMAN {
+    auto parse(std::span<char const> src) -> void {
         this->parse_header(src);
-        auto body = zstd_decompress(src.subspan(header.offset, header.length), header.body_length);
+        auto const compressed = src.subspan(header.offset, header.length);
+        rlib_assert(body.resize_destroy(header.body_length));
+        rlib_assert(zstd_decompress_into(compressed, body) == header.body_length);
         auto offset = Offset{body.data(), 0, (std::int32_t)body.size()};
         auto body_table = offset.as<Table>();
         this->parse_langs(body_table[1].as<std::vector<Table>>());
@@ -187,18 +226,95 @@ struct RMAN::Raw {
         this->parse_params(body_table[5].as<std::vector<Table>>());
         // this->parse_keys(body_table[4].as<std::vector<Table>>());
         this->parse_bundles(body_table[0].as<std::vector<Table>>());
-        this->parse_files(body_table[2].as<std::vector<Table>>());
-        return RMAN{
-            .manifestId = std::move(this->header.manifestId),
-            .files = std::move(this->files),
-            .bundles = std::move(this->bundles),
+        this->parse_files(body_table[2]);
+    }
+
+    auto file(std::size_t index) const -> View::File {
+        rlib_assert(index < file_count);
+        auto offset = file_tables;
+        offset.cur += (std::int32_t)(index * sizeof(std::int32_t));
+        auto file_table = offset.as<Table>();
+        auto fileId = file_table[0].as<FileID>();
+        auto name = file_table[3].as<std::string_view>();
+        rlib_trace("File: %016llX(%.*s)", (unsigned long long)fileId, (int)name.size(), name.data());
+        auto dirId = file_table[1].as<std::uint64_t>();
+        auto size = file_table[2].as<std::uint64_t>();
+        auto locale_flags = file_table[4].as<std::uint64_t>();
+        // 5: ???, unk size
+        // 6: ???, unk size
+        auto chunk_ids = vector_bytes(file_table[7], sizeof(ChunkID));
+        // 8: set to 1 when part of .app
+        auto link = file_table[9].as<std::string_view>();
+        // 10: ???, unk size
+        auto params_index = file_table[11].as<std::uint8_t>();
+        auto permissions = file_table[12].as<std::uint8_t>();
+        rlib_assert(fileId != FileID::None);
+        rlib_assert(!name.empty());
+        auto const& params = rlib_rethrow(lookup_params.at(params_index));
+        return View::File{
+            .fileId = fileId,
+            .permissions = permissions,
+            .size = size,
+            .dir = dir_path(dirId),
+            .name = name,
+            .link = link,
+            .locale_flags = locale_flags,
+            .hash_type = params.hash_type,
+            .chunk_ids = chunk_ids,
         };
     }
 
+    auto langs(std::uint64_t locale_flags) const -> Langs {
+        auto result = Langs{};
+        for (std::size_t i = 0; i != lookup_lang_bit.size(); i++) {
+            if (!(locale_flags & (1ull << i))) {
+                continue;
+            }
+            rlib_trace("LangID: %u", (unsigned int)i);
+            rlib_assert(lookup_lang_bit[i]);
+            result.mask |= lookup_lang_bit[i];
+        }
+        return result;
+    }
+
+    auto chunks(View::File const& file, std::vector<RChunk::Dst>& out) const -> void {
+        out.clear();
+        out.reserve(file.chunk_ids.size() / sizeof(ChunkID));
+        for (std::uint64_t uncompressed_offset = 0, i = 0; i != file.chunk_ids.size(); i += sizeof(ChunkID)) {
+            auto chunk_id = ChunkID{};
+            memcpy(&chunk_id, file.chunk_ids.data() + i, sizeof(ChunkID));
+            rlib_trace("ChunkID: %016llX", (unsigned long long)chunk_id);
+            auto entry = lookup_chunk.find(chunk_id);
+            rlib_assert(entry);
+            auto chunk_src = entry->src(chunk_id, bundles[entry->bundle].bundleId);
+            auto chunk_dst = RChunk::Dst{chunk_src, file.hash_type, uncompressed_offset};
+            out.push_back(chunk_dst);
+            uncompressed_offset += chunk_dst.uncompressed_size;
+            rlib_assert(uncompressed_offset <= file.size);
+        }
+    }
+
+    auto read(std::size_t index, RFile& rfile) const -> void {
+        auto const file = this->file(index);
+        rlib_trace("File: %016llX(%.*s)", (unsigned long long)file.fileId, (int)file.name.size(), file.name.data());
+        rfile.fileId = file.fileId;
+        rfile.permissions = file.permissions;
+        rfile.size = file.size;
+        rfile.path.assign(file.dir);
+        rfile.path.append(file.name);
+        rfile.link.assign(file.link);
+        rfile.langs = this->langs(file.locale_flags);
+        rfile.time = {};
+        if (!rfile.chunks) {
+            rfile.chunks.emplace();
+        }
+        this->chunks(file, *rfile.chunks);
+    }
+
 private:
     auto parse_header(std::span<char const> src) -> void {
         rlib_assert(src.size() >= sizeof(Header));
-        std::memcpy(this, src.data(), sizeof(Header));
+        std::memcpy(&header, src.data(), sizeof(Header));
         rlib_assert(header.magic == Header::MAGIC);  // RMAN
         rlib_assert(header.version_major == 2);
         rlib_assert(header.length >= 4);
@@ -210,12 +326,14 @@ private:
 
     auto parse_langs(std::vector<Table> lang_tables) -> void {
         auto re_lang = std::regex("[\\w\\.\\-_]+", std::regex::optimize);
-        lookup_lang_name.reserve(lang_tables.size());
         for (Table const& lang_table : lang_tables) {
             auto id = lang_table[0].as<std::uint8_t>();
             auto name = lang_table[1].as<std::string>();
             rlib_assert(std::regex_match(name, re_lang));
-            lookup_lang_name[id] = name;
+            // locale flags only have bits for first 32 ids
+            if (id >= 1 && id <= lookup_lang_bit.size()) {
+                lookup_lang_bit[id - 1] = Langs::bit(name);
+            }
         }
     }
 
@@ -233,6 +351,49 @@ private:
             lookup_dir_name[id] = name;
             lookup_dir_parent[id] = parent;
         }
+        // resolve every directory up front so file lookups never modify tables
+        // broken directories are skipped here and only reported by dir_path once some file uses them
+        lookup_dir_path.reserve(dir_tables.size());
+        for (auto const& [id, parent] : lookup_dir_parent) {
+            try {
+                resolve_dir(id);
+            } catch (std::exception const&) {
+                error_stack().clear();
+            }
+        }
+    }
+
+    auto dir_path(std::uint64_t dirId) const -> std::string const& {
+        static auto const root = std::string{};
+        if (!dirId) {
+            return root;
+        }
+        rlib_trace("DirID: %llu", (unsigned long long)dirId);
+        return rlib_rethrow(lookup_dir_path.at(dirId));
+    }
+
+    // Full path of directory, each directory is joined with its parent path only once.
+    auto resolve_dir(std::uint64_t dirId) -> std::string const& {
+        static auto const root = std::string{};
+        auto unresolved = std::vector<std::uint64_t>{};
+        auto prefix = &root;
+        while (dirId) {
+            if (auto i = lookup_dir_path.find(dirId); i != lookup_dir_path.end()) {
+                prefix = &i->second;
+                break;
+            }
+            rlib_trace("DirID: %llu", (unsigned long long)dirId);
+            rlib_assert(unresolved.size() < 256);
+            unresolved.push_back(dirId);
+            dirId = rlib_rethrow(lookup_dir_parent.at(dirId));
+        }
+        // children were pushed before their parents, resolve from one closest to root
+        for (auto i = unresolved.rbegin(); i != unresolved.rend(); ++i) {
+            auto path = *prefix + rlib_rethrow(lookup_dir_name.at(*i));
+            rlib_assert(path.size() < 256);
+            prefix = &lookup_dir_path.emplace(*i, std::move(path)).first->second;
+        }
+        return *prefix;
     }
 
     auto parse_params(std::vector<Table> params_tables) -> void {
@@ -255,6 +416,7 @@ private:
     }
 
     auto parse_bundles(std::vector<Table> bundle_tables) -> void {
+        auto chunks = std::vector<std::pair<ChunkID, ChunkIndex::Entry>>{};
         bundles.reserve(bundle_tables.size());
         for (Table const& bundle_table : bundle_tables) {
             auto bundleId = bundle_table[0].as<BundleID>();
@@ -277,89 +439,108 @@ private:
                 };
                 auto chunk_src = RChunk::Src{chunk, bundle.bundleId, compressed_offset};
                 bundle.chunks.push_back(chunk);
-                lookup_chunk[chunkId] = chunk_src;
+                chunks.emplace_back(chunkId, ChunkIndex::Entry::from(chunk_src, (std::uint32_t)(bundles.size() - 1)));
                 compressed_offset += compressed_size;
             }
         }
+        lookup_chunk = ChunkIndex(std::move(chunks));
     }
 
-    auto parse_files(std::vector<Table> file_tables) -> void {
-        for (Table const& file_table : file_tables) {
-            auto fileId = file_table[0].as<FileID>();
-            auto dirId = file_table[1].as<std::uint64_t>();
-            auto size = file_table[2].as<std::uint64_t>();
-            auto name = file_table[3].as<std::string>();
-            auto locale_flags = file_table[4].as<std::uint64_t>();
-            auto unk5 = file_table[5].as<std::uint8_t>();  // ???, unk size
-            auto unk6 = file_table[6].as<std::uint8_t>();  // ???, unk size
-            auto chunk_ids = file_table[7].as<std::vector<ChunkID>>();
-            auto unk8 = file_table[8].as<std::uint8_t>();  // set to 1 when part of .app
-            auto link = file_table[9].as<std::string>();
-            auto unk10 = file_table[10].as<std::uint8_t>();  // ???, unk size
-            auto params_index = file_table[11].as<std::uint8_t>();
-            auto permissions = file_table[12].as<std::uint8_t>();
-            rlib_trace("File: %016llX(%s)", (unsigned long long)fileId, name.c_str());
-            rlib_assert(fileId != FileID::None);
-            rlib_assert(!name.empty());
-            auto params = rlib_rethrow(lookup_params.at(params_index));
-            auto path = name;
-            while (dirId) {
-                rlib_trace("DirID: %llu", (unsigned long long)dirId);
-                rlib_assert(path.size() < 256);
-                if (auto const& name = rlib_rethrow(lookup_dir_name.at(dirId)); !name.empty()) {
-                    path = name + path;
-                }
-                dirId = rlib_rethrow(lookup_dir_parent.at(dirId));
-            }
-            auto langs = std::string{};
-            for (std::size_t i = 0; i != 32; i++) {
-                rlib_trace("LangID: %u", (unsigned int)i);
-                if (!(locale_flags & (1ull << i))) {
-                    continue;
-                }
-                auto const& name = rlib_rethrow(lookup_lang_name.at(i + 1));
-                if (!langs.empty()) {
-                    langs += ";";
-                }
-                langs += name;
-            }
-            if (langs.empty()) {
-                langs = "none";
-            }
-            auto chunks = std::vector<RChunk::Dst>{};
-            chunks.reserve(chunk_ids.size());
-            for (std::uint64_t uncompressed_offset = 0; auto chunk_id : chunk_ids) {
-                rlib_trace("ChunkID: %016llX", (unsigned long long)chunk_id);
-                auto& chunk_src = rlib_rethrow(lookup_chunk.at(chunk_id));
-                auto chunk_dst = RChunk::Dst{chunk_src, params.hash_type, uncompressed_offset};
-                chunks.push_back(chunk_dst);
-                uncompressed_offset += chunk_dst.uncompressed_size;
-                rlib_assert(uncompressed_offset <= size);
-            }
-            (void)unk5;
-            (void)unk6;
-            (void)unk8;
-            (void)unk10;
-            files.push_back(RFile{
-                .fileId = fileId,
-                .permissions = permissions,
-                .size = size,
-                .path = std::move(path),
-                .link = std::move(link),
-                .langs = std::move(langs),
-                .chunks = std::move(chunks),
-            });
+    // Only offsets of file tables are kept, tables themselves are decoded when file is asked for.
+    auto parse_files(Offset offset) -> void {
+        file_tables = offset.as<Offset>();
+        file_count = 0;
+        if (!file_tables) {
+            return;
         }
+        auto size = file_tables.as<std::int32_t>();
+        rlib_assert(size >= 0);
+        file_tables.cur += sizeof(std::int32_t);
+        rlib_assert(file_tables.cur + (std::int64_t)size * (std::int64_t)sizeof(std::int32_t) <= file_tables.end);
+        file_count = (std::size_t)size;
     }
 };
 
-auto RMAN::read(std::span<char const> data) -> RMAN {
+// File tables are independent once lookups are built, each task decodes its own range straight into out.
+static auto read_parallel(auto const& raw, std::size_t index, std::span<RFile> out, ThreadPool* pool) -> void {
+    static constexpr std::size_t TASK_FILES = 1024;
+    if (!pool || pool->size() <= 1 || out.size() <= TASK_FILES) {
+        for (auto& rfile : out) {
+            raw.read(index++, rfile);
+        }
+        return;
+    }
+    auto results = std::vector<std::future<void>>{};
+    for (std::size_t start = 0; start < out.size(); start += TASK_FILES) {
+        auto const range = out.subspan(start, std::min(TASK_FILES, out.size() - start));
+        results.push_back(pool->submit([&raw, range, index = index + start]() mutable {
+            for (auto& rfile : range) {
+                raw.read(index++, rfile);
+            }
+        }));
+    }
+    // wait for everything before rethrowing so error is always from first bad file
+    for (auto& result : results) {
+        result.wait();
+    }
+    for (auto& result : results) {
+        result.get();
+    }
+}
+
+// Starting threads for small manifests costs more than decoding them.
+static auto decode_threads(std::uint32_t threads, std::size_t files) noexcept -> std::uint32_t {
+    if (!threads) {
+        threads = ThreadPool::hardware_threads();
+    }
+    return (std::uint32_t)std::min<std::size_t>(threads, files / 4096);
+}
+
+auto RMAN::read(std::span<char const> data, std::uint32_t threads) -> RMAN {
     rlib_assert(data.size() >= 5);
-    return Raw{}.parse(data);
+    auto raw = Raw{};
+    raw.parse(data);
+    auto files = std::vector<RFile>(raw.file_count);
+    auto pool = ThreadPool(decode_threads(threads, files.size()));
+    read_parallel(raw, 0, files, &pool);
+    return RMAN{
+        .manifestId = raw.header.manifestId,
+        .files = std::move(files),
+        .bundles = std::move(raw.bundles),
+    };
 }
 
-auto RMAN::read_file(fs::path const& path) -> RMAN {
+auto RMAN::read_file(fs::path const& path, std::uint32_t threads) -> RMAN {
     auto infile = IO::MMap(path, IO::READ);
     auto data = infile.copy(0, infile.size());
-    return RMAN::read(data);
+    return RMAN::read(data, threads);
+}
+
+RMAN::View::View(std::span<char const> data, std::uint32_t threads) : raw_(std::make_unique<Raw>()) {
+    rlib_assert(data.size() >= 5);
+    raw_->parse(data);
+    pool_ = std::make_unique<ThreadPool>(decode_threads(threads, raw_->file_count));
+}
+
+RMAN::View::View(View&&) noexcept = default;
+
+RMAN::View::~View() noexcept = default;
+
+auto RMAN::View::manifestId() const noexcept -> ManifestID { return raw_->header.manifestId; }
+
+auto RMAN::View::bundles() const noexcept -> std::vector<RBUN> const& { return raw_->bundles; }
+
+auto RMAN::View::size() const noexcept -> std::size_t { return raw_->file_count; }
+
+auto RMAN::View::file(std::size_t index) const -> File { return raw_->file(index); }
+
+auto RMAN::View::langs(std::uint64_t locale_flags) const -> Langs { return raw_->langs(locale_flags); }
+
+auto RMAN::View::chunks(File const& file, std::vector<RChunk::Dst>& out) const -> void { raw_->chunks(file, out); }
+
+auto RMAN::View::read(std::size_t index, RFile& rfile) const -> void { raw_->read(index, rfile); }
+
+auto RMAN::View::read(std::size_t index, std::span<RFile> out) const -> void {
+    rlib_assert(index <= size() && out.size() <= size() - index);
+    read_parallel(*raw_, index, out, pool_.get());
 }
@@ -2,8 +2,10 @@
 #include <cinttypes>
 #include <cstddef>
 #include <filesystem>
+#include <memory>
 #include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "rbundle.hpp"
@@ -20,10 +22,53 @@ namespace rlib {
         std::vector<RFile> files;
         std::vector<RBUN> bundles;
 
-        static auto read(std::span<char const> data) -> RMAN;
-        static auto read_file(fs::path const& path) -> RMAN;
+        struct View;
+
+        // 0 threads decodes file tables on all cores.
+        static auto read(std::span<char const> data, std::uint32_t threads = 0) -> RMAN;
+        static auto read_file(fs::path const& path, std::uint32_t threads = 0) -> RMAN;
 
     private:
         struct Raw;
     };
+
+    // Keeps decompressed manifest body alive and decodes file tables one at time when asked.
+    struct RMAN::View {
+        // Strings point into manifest body or its lookup tables and live as long as view.
+        struct File {
+            FileID fileId;
+            std::uint8_t permissions;
+            std::uint64_t size;
+            std::string_view dir;
+            std::string_view name;
+            std::string_view link;
+            std::uint64_t locale_flags;
+            HashType hash_type;
+            // Packed chunk ids, decoded with View::chunks.
+            std::span<char const> chunk_ids;
+        };
+
+        // Large manifests get pool of threads (0 for all cores) used when reading ranges of files.
+        explicit View(std::span<char const> data, std::uint32_t threads = 0);
+        View(View&&) noexcept;
+        ~View() noexcept;
+
+        auto manifestId() const noexcept -> ManifestID;
+        auto bundles() const noexcept -> std::vector<RBUN> const&;
+        auto size() const noexcept -> std::size_t;
+        auto file(std::size_t index) const -> File;
+
+        // Maps manifest locale flags to bits of shared language table.
+        auto langs(std::uint64_t locale_flags) const -> Langs;
+        auto chunks(File const& file, std::vector<RChunk::Dst>& out) const -> void;
+
+        // Overwrites every field of rfile, strings and chunks keep their capacity between files.
+        auto read(std::size_t index, RFile& rfile) const -> void;
+        // Same as reading files one by one from index, parts of out are decoded side by side.
+        auto read(std::size_t index, std::span<RFile> out) const -> void;
+
+    private:
+        std::unique_ptr<Raw> raw_;
+        std::unique_ptr<ThreadPool> pool_;
+    };
 }
@@ -0,0 +1,360 @@
+#include "sha256.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <utility>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#    define RLIB_SHA256_X86
+#    include <immintrin.h>
+#    ifdef _MSC_VER
+#        include <intrin.h>
+#        define RLIB_SHA256_TARGET
+#        define RLIB_SHA256_AVX2_TARGET
+#    else
+#        include <cpuid.h>
+#        define RLIB_SHA256_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#        define RLIB_SHA256_AVX2_TARGET __attribute__((target("avx2")))
+#    endif
+#endif
+
+using namespace rlib;
+
+using compress_fn = void (*)(std::uint32_t* state, std::uint8_t const* blocks, std::size_t count) noexcept;
+using lanes_fn = void (*)(SHA256::State* states, SHA256::Block const* blocks, std::size_t count) noexcept;
+
+alignas(16) static constexpr std::uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static auto sha256_load_be(std::uint8_t const* src) noexcept -> std::uint32_t {
+    return ((std::uint32_t)src[0] << 24) | ((std::uint32_t)src[1] << 16) | ((std::uint32_t)src[2] << 8) |
+           (std::uint32_t)src[3];
+}
+
+static auto sha256_compress_portable(std::uint32_t* state, std::uint8_t const* blocks, std::size_t count) noexcept
+    -> void {
+    for (; count; --count, blocks += 64) {
+        std::uint32_t w[64];
+        for (std::size_t i = 0; i != 16; ++i) {
+            w[i] = sha256_load_be(blocks + i * 4);
+        }
+        for (std::size_t i = 16; i != 64; ++i) {
+            auto const s0 = std::rotr(w[i - 15], 7) ^ std::rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            auto const s1 = std::rotr(w[i - 2], 17) ^ std::rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        auto a = state[0], b = state[1], c = state[2], d = state[3];
+        auto e = state[4], f = state[5], g = state[6], h = state[7];
+        for (std::size_t i = 0; i != 64; ++i) {
+            auto const s1 = std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25);
+            auto const ch = (e & f) ^ (~e & g);
+            auto const t1 = h + s1 + ch + SHA256_K[i] + w[i];
+            auto const s0 = std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22);
+            auto const maj = (a & b) ^ (a & c) ^ (b & c);
+            auto const t2 = s0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+static auto sha256_lanes_portable(SHA256::State* states, SHA256::Block const* blocks, std::size_t count) noexcept
+    -> void {
+    for (; count; --count, ++states, ++blocks) {
+        sha256_compress_portable(states->data(), blocks->data(), 1);
+    }
+}
+
+#ifdef RLIB_SHA256_X86
+struct SHA256CPU {
+    bool sha;
+    bool avx2;
+};
+
+static auto sha256_cpu() noexcept -> SHA256CPU {
+    auto result = SHA256CPU{};
+    unsigned int regs[4] = {};
+#    ifdef _MSC_VER
+    __cpuid((int*)regs, 0);
+    if (regs[0] < 7) {
+        return result;
+    }
+    __cpuidex((int*)regs, 1, 0);
+    auto const sse = (regs[2] & (1u << 19)) && (regs[2] & (1u << 9));
+    // avx registers also need os support
+    auto const ymm = (regs[2] & (1u << 27)) && (regs[2] & (1u << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex((int*)regs, 7, 0);
+    result.avx2 = ymm && (regs[1] & (1u << 5));
+#    else
+    if (!__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3])) {
+        return result;
+    }
+    auto const sse = (regs[2] & (1u << 19)) && (regs[2] & (1u << 9));
+    if (!__get_cpuid_count(7, 0, &regs[0], &regs[1], &regs[2], &regs[3])) {
+        return result;
+    }
+    result.avx2 = __builtin_cpu_supports("avx2");
+#    endif
+    // sse4.1 and ssse3 from leaf 1, sha from leaf 7
+    result.sha = sse && (regs[1] & (1u << 29));
+    return result;
+}
+
+RLIB_SHA256_TARGET static inline auto sha256_shani_rounds(__m128i& state0,
+                                                          __m128i& state1,
+                                                          __m128i msg,
+                                                          std::size_t round) noexcept -> void {
+    msg = _mm_add_epi32(msg, _mm_load_si128((__m128i const*)&SHA256_K[round]));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+}
+
+RLIB_SHA256_TARGET static inline auto sha256_shani_schedule(__m128i m0, __m128i m1, __m128i m2, __m128i m3) noexcept
+    -> __m128i {
+    // next 4 words of message schedule from previous 16
+    return _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), _mm_alignr_epi8(m3, m2, 4)), m3);
+}
+
+RLIB_SHA256_TARGET static inline auto sha256_shani_load(std::uint32_t const* state,
+                                                        __m128i& state0,
+                                                        __m128i& state1) noexcept -> void {
+    // sha instructions want state as ABEF and CDGH
+    auto const tmp = _mm_shuffle_epi32(_mm_loadu_si128((__m128i const*)&state[0]), 0xB1);
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((__m128i const*)&state[4]), 0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+}
+
+RLIB_SHA256_TARGET static inline auto sha256_shani_store(std::uint32_t* state, __m128i state0, __m128i state1) noexcept
+    -> void {
+    auto const tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+RLIB_SHA256_TARGET static inline auto sha256_shani_message(std::uint8_t const* block, __m128i (&m)[4]) noexcept
+    -> void {
+    auto const mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    for (std::size_t i = 0; i != 4; ++i) {
+        m[i] = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const*)(block + i * 16)), mask);
+    }
+}
+
+RLIB_SHA256_TARGET static auto sha256_compress_shani(std::uint32_t* state,
+                                                     std::uint8_t const* blocks,
+                                                     std::size_t count) noexcept -> void {
+    __m128i state0, state1;
+    sha256_shani_load(state, state0, state1);
+    for (; count; --count, blocks += 64) {
+        auto const save0 = state0;
+        auto const save1 = state1;
+        __m128i m[4];
+        sha256_shani_message(blocks, m);
+        for (std::size_t round = 0; round != 64; round += 16) {
+            for (std::size_t i = 0; i != 4; ++i) {
+                sha256_shani_rounds(state0, state1, m[i], round + i * 4);
+            }
+            if (round != 48) {
+                for (std::size_t i = 0; i != 4; ++i) {
+                    m[i] = sha256_shani_schedule(m[i], m[(i + 1) % 4], m[(i + 2) % 4], m[(i + 3) % 4]);
+                }
+            }
+        }
+        state0 = _mm_add_epi32(state0, save0);
+        state1 = _mm_add_epi32(state1, save1);
+    }
+    sha256_shani_store(state, state0, state1);
+}
+
+RLIB_SHA256_TARGET static auto sha256_lanes_shani(SHA256::State* states,
+                                                  SHA256::Block const* blocks,
+                                                  std::size_t count) noexcept -> void {
+    // rounds of single state depend on each other, two interleaved states keep sha unit busy
+    for (; count >= 2; count -= 2, states += 2, blocks += 2) {
+        __m128i a0, a1, b0, b1;
+        sha256_shani_load(states[0].data(), a0, a1);
+        sha256_shani_load(states[1].data(), b0, b1);
+        auto const save_a0 = a0, save_a1 = a1, save_b0 = b0, save_b1 = b1;
+        __m128i ma[4], mb[4];
+        sha256_shani_message(blocks[0].data(), ma);
+        sha256_shani_message(blocks[1].data(), mb);
+        for (std::size_t round = 0; round != 64; round += 16) {
+            for (std::size_t i = 0; i != 4; ++i) {
+                sha256_shani_rounds(a0, a1, ma[i], round + i * 4);
+                sha256_shani_rounds(b0, b1, mb[i], round + i * 4);
+            }
+            if (round != 48) {
+                for (std::size_t i = 0; i != 4; ++i) {
+                    ma[i] = sha256_shani_schedule(ma[i], ma[(i + 1) % 4], ma[(i + 2) % 4], ma[(i + 3) % 4]);
+                    mb[i] = sha256_shani_schedule(mb[i], mb[(i + 1) % 4], mb[(i + 2) % 4], mb[(i + 3) % 4]);
+                }
+            }
+        }
+        sha256_shani_store(states[0].data(), _mm_add_epi32(a0, save_a0), _mm_add_epi32(a1, save_a1));
+        sha256_shani_store(states[1].data(), _mm_add_epi32(b0, save_b0), _mm_add_epi32(b1, save_b1));
+    }
+    if (count) {
+        sha256_compress_shani(states->data(), blocks->data(), 1);
+    }
+}
+
+RLIB_SHA256_AVX2_TARGET static inline auto sha256_avx2_rotr(__m256i x, int n) noexcept -> __m256i {
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+RLIB_SHA256_AVX2_TARGET static auto sha256_lanes_avx2(SHA256::State* states,
+                                                      SHA256::Block const* blocks,
+                                                      std::size_t count) noexcept -> void {
+    constexpr auto r = &sha256_avx2_rotr;
+    while (count) {
+        // every lane is separate state, missing lanes repeat first one and are not stored
+        auto const lanes = std::min(count, std::size_t{8});
+        alignas(32) std::uint32_t tmp[16][8];
+        __m256i v[8], w[16];
+        for (std::size_t word = 0; word != 8; ++word) {
+            for (std::size_t lane = 0; lane != 8; ++lane) {
+                tmp[word][lane] = states[lane < lanes ? lane : 0][word];
+            }
+            v[word] = _mm256_load_si256((__m256i const*)tmp[word]);
+        }
+        for (std::size_t word = 0; word != 16; ++word) {
+            for (std::size_t lane = 0; lane != 8; ++lane) {
+                tmp[word][lane] = sha256_load_be(blocks[lane < lanes ? lane : 0].data() + word * 4);
+            }
+            w[word] = _mm256_load_si256((__m256i const*)tmp[word]);
+        }
+        auto a = v[0], b = v[1], c = v[2], d = v[3], e = v[4], f = v[5], g = v[6], h = v[7];
+        for (std::size_t i = 0; i != 64; ++i) {
+            if (i >= 16) {
+                auto const w15 = w[(i - 15) % 16];
+                auto const w2 = w[(i - 2) % 16];
+                auto const s0 = _mm256_xor_si256(_mm256_xor_si256(r(w15, 7), r(w15, 18)), _mm256_srli_epi32(w15, 3));
+                auto const s1 = _mm256_xor_si256(_mm256_xor_si256(r(w2, 17), r(w2, 19)), _mm256_srli_epi32(w2, 10));
+                w[i % 16] = _mm256_add_epi32(_mm256_add_epi32(w[i % 16], s0), _mm256_add_epi32(w[(i - 7) % 16], s1));
+            }
+            auto const s1 = _mm256_xor_si256(_mm256_xor_si256(r(e, 6), r(e, 11)), r(e, 25));
+            auto const ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            auto const k = _mm256_set1_epi32((int)SHA256_K[i]);
+            auto const t1 = _mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(h, s1), _mm256_add_epi32(ch, k)),
+                                             w[i % 16]);
+            auto const s0 = _mm256_xor_si256(_mm256_xor_si256(r(a, 2), r(a, 13)), r(a, 22));
+            auto const maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(t1, _mm256_add_epi32(s0, maj));
+        }
+        __m256i const out[8] = {a, b, c, d, e, f, g, h};
+        for (std::size_t word = 0; word != 8; ++word) {
+            _mm256_store_si256((__m256i*)tmp[word], _mm256_add_epi32(v[word], out[word]));
+            for (std::size_t lane = 0; lane != lanes; ++lane) {
+                states[lane][word] = tmp[word][lane];
+            }
+        }
+        states += lanes;
+        blocks += lanes;
+        count -= lanes;
+    }
+}
+#endif
+
+struct SHA256Engine {
+    compress_fn compress;
+    lanes_fn lanes;
+    char const* name;
+};
+
+static auto sha256_engine() noexcept -> SHA256Engine const& {
+    static auto const engine = []() -> SHA256Engine {
+#ifdef RLIB_SHA256_X86
+        auto const cpu = sha256_cpu();
+        if (cpu.sha) {
+            return {&sha256_compress_shani, &sha256_lanes_shani, "sha-ni"};
+        }
+        if (cpu.avx2) {
+            return {&sha256_compress_portable, &sha256_lanes_avx2, "avx2"};
+        }
+#endif
+        return {&sha256_compress_portable, &sha256_lanes_portable, "portable"};
+    }();
+    return engine;
+}
+
+auto SHA256::absorb(void const* data, std::size_t size) noexcept -> SHA256& {
+    auto const compress = sha256_engine().compress;
+    auto src = (std::uint8_t const*)data;
+    auto const used = (std::size_t)(size_ % 64);
+    size_ += size;
+    if (used) {
+        auto const take = std::min(size, 64 - used);
+        std::memcpy(block_.data() + used, src, take);
+        src += take;
+        size -= take;
+        if (used + take != 64) {
+            return *this;
+        }
+        compress(state_.data(), block_.data(), 1);
+    }
+    if (auto const count = size / 64) {
+        compress(state_.data(), src, count);
+        src += count * 64;
+        size -= count * 64;
+    }
+    std::memcpy(block_.data(), src, size);
+    return *this;
+}
+
+auto SHA256::digest() noexcept -> Digest {
+    auto const bits = size_ * 8;
+    auto const used = (std::size_t)(size_ % 64);
+    // padding is 0x80, zeros and big endian bit length which might spill into one more block
+    auto padding = std::array<std::uint8_t, 72>{0x80};
+    auto const padding_size = (used < 56 ? 56 - used : 120 - used);
+    for (std::size_t i = 0; i != 8; ++i) {
+        padding[padding_size + i] = (std::uint8_t)(bits >> (56 - i * 8));
+    }
+    this->absorb(padding.data(), padding_size + 8);
+    auto result = Digest{};
+    for (std::size_t i = 0; i != 8; ++i) {
+        result[i * 4 + 0] = (std::uint8_t)(state_[i] >> 24);
+        result[i * 4 + 1] = (std::uint8_t)(state_[i] >> 16);
+        result[i * 4 + 2] = (std::uint8_t)(state_[i] >> 8);
+        result[i * 4 + 3] = (std::uint8_t)(state_[i]);
+    }
+    return result;
+}
+
+auto SHA256::compress_lanes(std::span<State> states, std::span<Block const> blocks) noexcept -> void {
+    sha256_engine().lanes(states.data(), blocks.data(), std::min(states.size(), blocks.size()));
+}
+
+auto SHA256::engine() noexcept -> char const* { return sha256_engine().name; }
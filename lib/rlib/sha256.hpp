@@ -0,0 +1,42 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace rlib {
+    // SHA-256 that picks cpu sha extensions at runtime and falls back to portable code.
+    // Copying a partially absorbed hasher is cheap, which lets HMAC reuse its padded key blocks.
+    struct SHA256 {
+        using Digest = std::array<std::uint8_t, 32>;
+        using State = std::array<std::uint32_t, 8>;
+        using Block = std::array<std::uint8_t, 64>;
+
+        static constexpr State INIT = {
+            0x6a09e667,
+            0xbb67ae85,
+            0x3c6ef372,
+            0xa54ff53a,
+            0x510e527f,
+            0x9b05688c,
+            0x1f83d9ab,
+            0x5be0cd19,
+        };
+
+        auto absorb(void const* data, std::size_t size) noexcept -> SHA256&;
+
+        auto digest() noexcept -> Digest;
+
+        // Compresses one block into each of independent states.
+        // States are interleaved on sha units or spread over simd lanes so they do not wait on each other.
+        static auto compress_lanes(std::span<State> states, std::span<Block const> blocks) noexcept -> void;
+
+        // Name of compression engine picked for this cpu.
+        static auto engine() noexcept -> char const*;
+
+    private:
+        State state_ = INIT;
+        Block block_ = {};
+        std::uint64_t size_ = {};
+    };
+}
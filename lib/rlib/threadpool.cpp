@@ -0,0 +1,63 @@
+#include "threadpool.hpp"
+
+#include <algorithm>
+
+using namespace rlib;
+
+ThreadPool::ThreadPool(std::uint32_t threads, std::size_t queue_limit) {
+    if (threads <= 1) {
+        return;
+    }
+    queue_limit_ = queue_limit ? queue_limit : threads * 4;
+    threads_.reserve(threads);
+    for (std::uint32_t i = 0; i != threads; ++i) {
+        threads_.emplace_back([this] { this->run(); });
+    }
+}
+
+ThreadPool::~ThreadPool() noexcept {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    cv_push_.notify_all();
+    cv_pop_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+auto ThreadPool::hardware_threads() noexcept -> std::uint32_t {
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+auto ThreadPool::push(std::function<void()> task) -> void {
+    if (threads_.empty()) {
+        task();
+        return;
+    }
+    {
+        // block producer untill workers catch up so queued tasks do not grow unbounded
+        std::unique_lock lock(mutex_);
+        cv_pop_.wait(lock, [this] { return stop_ || tasks_.size() < queue_limit_; });
+        tasks_.push_back(std::move(task));
+    }
+    cv_push_.notify_one();
+}
+
+auto ThreadPool::run() noexcept -> void {
+    for (;;) {
+        auto task = std::function<void()>{};
+        {
+            std::unique_lock lock(mutex_);
+            cv_push_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        cv_pop_.notify_one();
+        task();
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace rlib {
+    struct ThreadPool {
+        // 0 or 1 threads runs every task inline on the calling thread
+        ThreadPool(std::uint32_t threads, std::size_t queue_limit = 0);
+        ThreadPool(ThreadPool const&) = delete;
+        ~ThreadPool() noexcept;
+
+        static auto hardware_threads() noexcept -> std::uint32_t;
+
+        auto size() const noexcept -> std::uint32_t { return (std::uint32_t)threads_.size(); }
+
+        // tasks pushed directly must not throw, use submit to collect exceptions
+        auto push(std::function<void()> task) -> void;
+
+        template <typename Func, typename Result = std::invoke_result_t<Func>>
+        auto submit(Func&& func) -> std::future<Result> {
+            auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Func>(func));
+            auto result = task->get_future();
+            this->push([task = std::move(task)] { (*task)(); });
+            return result;
+        }
+
+    private:
+        std::vector<std::thread> threads_;
+        std::deque<std::function<void()>> tasks_;
+        std::size_t queue_limit_ = {};
+        bool stop_ = {};
+        std::mutex mutex_;
+        std::condition_variable cv_push_;
+        std::condition_variable cv_pop_;
+
+        auto run() noexcept -> void;
+    };
+}
@@ -1,20 +1,28 @@
 #include <argparse.hpp>
 #include <iostream>
+#include <rlib/buffer.hpp>
 #include <rlib/common.hpp>
 #include <rlib/iofile.hpp>
 #include <rlib/rbundle.hpp>
+#include <rlib/rfile.hpp>
 #include <thread>
+#include <unordered_map>
 
 using namespace rlib;
 
 struct Main {
+    static constexpr std::size_t HASH_GROUP = 16;
+
     struct CLI {
         std::vector<std::string> inputs = {};
+        std::string manifest = {};
+        HashType hash_type = {};
         bool no_hash = {};
         bool no_extract = {};
         bool no_progress = {};
         std::uint32_t parallel = {};
     } cli = {};
+    std::unordered_map<ChunkID, HashType> hash_types = {};
 
     auto parse_args(int argc, char** argv) -> void {
         argparse::ArgumentParser program(fs::path(argv[0]).filename().generic_string());
@@ -26,6 +34,12 @@ struct Main {
             .default_value(false)
             .implicit_value(true);
         program.add_argument("--no-hash").help("Do not verify hash.").default_value(false).implicit_value(true);
+        program.add_argument("--hash-type")
+            .help("Hash type to try first: auto, sha512, sha256, hkdf, blake3.")
+            .default_value(std::string("auto"));
+        program.add_argument("--manifest")
+            .help("Manifest to take chunk hash types from.")
+            .default_value(std::string(""));
         program.add_argument("--no-progress")
             .help("Do not print progress to cerr.")
             .default_value(false)
@@ -40,12 +54,18 @@ struct Main {
         cli.no_extract = program.get<bool>("--no-hash");
         cli.no_progress = program.get<bool>("--no-progress");
         cli.parallel = program.get<uint32_t>("--parallel");
+        cli.hash_type = RChunk::hash_type_parse(program.get<std::string>("--hash-type"));
+        cli.manifest = program.get<std::string>("--manifest");
         cli.inputs = program.get<std::vector<std::string>>("input");
     }
 
     auto run() -> void {
         std::cerr << "Collecting input bundles ... " << std::endl;
         auto paths = collect_files(cli.inputs, [](fs::path const& p) { return p.extension() == ".bundle"; });
+        if (!cli.manifest.empty()) {
+            std::cerr << "Reading manifest hash types ... " << std::endl;
+            hash_types = RFile::read_hash_types(cli.manifest);
+        }
         std::cerr << "Processing input bundles ... " << std::endl;
 
         const auto parallel = cli.parallel;
@@ -70,32 +90,105 @@ struct Main {
         for (auto& t : threads) t.join();
     }
 
+    // Type from manifest when it knows the chunk, otherwise whatever matched last in this bundle.
+    auto hash_type_hint(ChunkID chunkId, HashType last) const -> HashType {
+        if (auto i = hash_types.find(chunkId); i != hash_types.end()) {
+            return i->second;
+        }
+        return last;
+    }
+
+    // Decompresses group of chunks and hashes them together.
+    auto extract_chunks(std::span<RChunk const> chunks,
+                        std::span<IO::ReadOp const> ops,
+                        Buffer& unpacked,
+                        HashType& last) const -> void {
+        auto total = std::size_t{};
+        for (auto const& chunk : chunks) {
+            total += chunk.uncompressed_size;
+        }
+        rlib_assert(unpacked.resize_destroy(total));
+        auto datas = std::vector<std::span<char const>>{};
+        for (auto pos = std::size_t{}; auto const& chunk : chunks) {
+            auto const dst = unpacked.subspan(pos, chunk.uncompressed_size);
+            auto const& src = ops[datas.size()].dst;
+            rlib_assert(zstd_frame_decompress_size(src) == chunk.uncompressed_size);
+            rlib_assert(zstd_decompress_into(src, dst) == chunk.uncompressed_size);
+            datas.push_back(dst);
+            pos += chunk.uncompressed_size;
+        }
+        if (cli.no_hash) {
+            return;
+        }
+        // chunks of one bundle nearly always share hash type, others get detected one by one
+        auto const ids = RChunk::hash_many(datas, hash_type_hint(chunks[0].chunkId, last));
+        for (std::size_t n = 0; n != chunks.size(); ++n) {
+            if (ids[n] != chunks[n].chunkId) {
+                auto const hint = hash_type_hint(chunks[n].chunkId, last);
+                auto hash_type = RChunk::hash_type(datas[n], chunks[n].chunkId, hint);
+                rlib_assert(hash_type != HashType::None);
+                last = hash_type;
+            }
+        }
+    }
+
     auto verify_bundle(fs::path const& path, std::uint32_t index, bool mt = false) -> void {
         try {
             rlib_trace("path: %s", path.generic_string().c_str());
             puts(("START: " + path.filename().generic_string()).c_str());
-            auto infile = IO::File(path, IO::READ);
+            auto infile = IO::File(path, IO::READ | IO::SEQUENTIAL);
             auto bundle = RBUN::read(infile, true);
             {
                 std::uint64_t offset = 0;
                 auto p = std::optional<progress_bar>{};
                 if (!mt) p.emplace("VERIFIED", cli.no_progress, index, offset, bundle.toc_offset);
-                for (auto const& chunk : bundle.chunks) {
-                    if (!cli.no_extract) {
-                        auto src = infile.copy(offset, chunk.compressed_size);
-                        auto dst = zstd_decompress(src, chunk.uncompressed_size);
-                        if (!cli.no_hash) {
-                            auto hash_type = RChunk::hash_type(dst, chunk.chunkId);
-                            rlib_assert(hash_type != HashType::None);
+                // frame header is enough to check decompressed size when not extracting
+                auto const read_size = [this](RChunk const& chunk) -> std::size_t {
+                    return cli.no_extract ? std::min(chunk.compressed_size, 32u) : chunk.compressed_size;
+                };
+                auto buffer = Buffer{};
+                auto unpacked = Buffer{};
+                auto last = cli.hash_type != HashType::None ? cli.hash_type : HashType::RITO_HKDF;
+                auto ops = std::vector<IO::ReadOp>{};
+                auto const chunks = std::span<RChunk const>(bundle.chunks);
+                for (std::size_t i = 0; i != chunks.size();) {
+                    // read many chunks in one batch
+                    auto count = std::size_t{};
+                    auto total = std::size_t{};
+                    for (; i + count != chunks.size(); ++count) {
+                        if (count && total + read_size(chunks[i + count]) > 32 * MiB) {
+                            break;
+                        }
+                        total += read_size(chunks[i + count]);
+                    }
+                    rlib_assert(buffer.resize_destroy(total));
+                    ops.clear();
+                    auto pos = std::size_t{};
+                    auto chunk_offset = offset;
+                    for (auto const& chunk : chunks.subspan(i, count)) {
+                        ops.push_back({chunk_offset, buffer.subspan(pos, read_size(chunk))});
+                        pos += read_size(chunk);
+                        chunk_offset += chunk.compressed_size;
+                    }
+                    rlib_assert(infile.read_batch(ops));
+                    // whole bundle is read once, do not let it push everything else out of page cache
+                    infile.dont_need(offset, chunk_offset - offset);
+                    for (std::size_t n = 0; n != count;) {
+                        auto const group = std::min(count - n, HASH_GROUP);
+                        if (!cli.no_extract) {
+                            auto const group_ops = std::span(ops).subspan(n, group);
+                            extract_chunks(chunks.subspan(i + n, group), group_ops, unpacked, last);
+                        }
+                        for (auto const& chunk : chunks.subspan(i + n, group)) {
+                            if (cli.no_extract) {
+                                rlib_assert(zstd_frame_decompress_size(ops[n].dst) == chunk.uncompressed_size);
+                            }
+                            offset += chunk.compressed_size;
+                            ++n;
                         }
-                    } else {
-                        char zstd_header[32];
-                        std::size_t header_size = std::min(chunk.compressed_size, 32u);
-                        rlib_assert(infile.read(offset, {zstd_header, header_size}));
-                        rlib_assert(zstd_frame_decompress_size({zstd_header, header_size}) == chunk.uncompressed_size);
+                        if (p) p->update(offset);
                     }
-                    offset += chunk.compressed_size;
-                    if (p) p->update(offset);
+                    i += count;
                 }
             }
             puts(("OK: " + path.filename().generic_string()).c_str());
@@ -4,6 +4,8 @@
 #include <rlib/common.hpp>
 #include <rlib/iofile.hpp>
 #include <rlib/rbundle.hpp>
+#include <rlib/rfile.hpp>
+#include <unordered_map>
 #include <unordered_set>
 
 using namespace rlib;
@@ -12,12 +14,16 @@ struct Main {
     struct CLI {
         std::string output = {};
         std::vector<std::string> inputs = {};
+        std::string manifest = {};
+        HashType hash_type = {};
         bool with_offset = {};
         bool force = {};
         bool no_hash = {};
         bool no_progress = {};
+        bool preallocate = {};
     } cli = {};
     std::unordered_set<std::string> seen = {};
+    std::unordered_map<ChunkID, HashType> hash_types = {};
 
     auto parse_args(int argc, char** argv) -> void {
         argparse::ArgumentParser program(fs::path(argv[0]).filename().generic_string());
@@ -31,10 +37,20 @@ struct Main {
             .default_value(false)
             .implicit_value(true);
         program.add_argument("--no-hash").help("Do not verify hash.").default_value(false).implicit_value(true);
+        program.add_argument("--hash-type")
+            .help("Hash type to try first: auto, sha512, sha256, hkdf, blake3.")
+            .default_value(std::string("auto"));
+        program.add_argument("--manifest")
+            .help("Manifest to take chunk hash types from.")
+            .default_value(std::string(""));
         program.add_argument("--no-progress")
             .help("Do not print progress to cerr.")
             .default_value(false)
             .implicit_value(true);
+        program.add_argument("--preallocate")
+            .help("Allocate whole chunk file before writing to it.")
+            .default_value(false)
+            .implicit_value(true);
 
         program.parse_args(argc, argv);
 
@@ -42,6 +58,9 @@ struct Main {
         cli.force = program.get<bool>("--force");
         cli.no_hash = program.get<bool>("--no-hash");
         cli.no_progress = program.get<bool>("--no-progress");
+        cli.preallocate = program.get<bool>("--preallocate");
+        cli.hash_type = RChunk::hash_type_parse(program.get<std::string>("--hash-type"));
+        cli.manifest = program.get<std::string>("--manifest");
 
         cli.output = program.get<std::string>("output");
         cli.inputs = program.get<std::vector<std::string>>("input");
@@ -63,21 +82,38 @@ struct Main {
                 seen.insert(entry.path().filename().generic_string());
             }
         }
+        if (!cli.manifest.empty()) {
+            std::cerr << "Reading manifest hash types ... " << std::endl;
+            hash_types = RFile::read_hash_types(cli.manifest);
+        }
         std::cerr << "Processing input bundles ... " << std::endl;
         for (std::uint32_t index = paths.size(); auto const& path : paths) {
             verify_bundle(path, index--);
         }
     }
 
+    // Type from manifest when it knows the chunk, otherwise whatever matched last in this bundle.
+    auto hash_type_hint(ChunkID chunkId, HashType last) const -> HashType {
+        if (auto i = hash_types.find(chunkId); i != hash_types.end()) {
+            return i->second;
+        }
+        return last;
+    }
+
     auto verify_bundle(fs::path const& path, std::uint32_t index) -> void {
         try {
             rlib_trace("path: %s", path.generic_string().c_str());
             std::cout << "START:" << path.filename().generic_string() << std::endl;
-            auto infile = IO::File(path, IO::READ);
+            auto infile = IO::File(path, IO::READ | IO::SEQUENTIAL);
             auto bundle = RBUN::read(infile, true);
+            auto out_flags = IO::WRITE | IO::NO_INTERUPT | IO::NO_OVERGROW;
+            if (cli.preallocate) {
+                out_flags = out_flags | IO::PREALLOCATE;
+            }
             {
                 std::uint64_t offset = 0;
                 progress_bar p("EXTRACTED", cli.no_progress, index, offset, bundle.toc_offset);
+                auto last = cli.hash_type != HashType::None ? cli.hash_type : HashType::RITO_HKDF;
                 for (auto const& chunk : bundle.chunks) {
                     auto name = fmt::format("{}.chunk", chunk.chunkId);
                     if (cli.with_offset) {
@@ -87,11 +123,13 @@ struct Main {
                         auto src = infile.copy(offset, chunk.compressed_size);
                         auto dst = zstd_decompress(src, chunk.uncompressed_size);
                         if (!cli.no_hash) {
-                            auto hash_type = RChunk::hash_type(dst, chunk.chunkId);
+                            auto hash_type = RChunk::hash_type(dst, chunk.chunkId, hash_type_hint(chunk.chunkId, last));
                             rlib_assert(hash_type != HashType::None);
+                            last = hash_type;
                         }
                         auto outpath = fs::path(cli.output) / name;
-                        auto outfile = IO::File(outpath, IO::WRITE | IO::NO_INTERUPT | IO::NO_OVERGROW);
+                        auto outfile = IO::File(outpath, out_flags);
+                        outfile.reserve(0, dst.size());
                         outfile.write(0, dst);
                         seen.insert(std::move(name));
                     }
@@ -1,9 +1,15 @@
 #include <argparse.hpp>
+#include <atomic>
+#include <deque>
+#include <future>
 #include <iostream>
 #include <rlib/common.hpp>
 #include <rlib/iofile.hpp>
 #include <rlib/rbundle.hpp>
 #include <rlib/rcache.hpp>
+#include <rlib/rfile.hpp>
+#include <rlib/threadpool.hpp>
+#include <unordered_map>
 
 using namespace rlib;
 
@@ -11,10 +17,14 @@ struct Main {
     struct CLI {
         RCache::Options output = {};
         std::vector<std::string> inputs = {};
+        std::string manifest = {};
+        HashType hash_type = {};
         int level_recompress = {};
         bool no_extract = {};
         bool no_progress = {};
+        std::uint32_t threads = 1;
     } cli = {};
+    std::unordered_map<ChunkID, HashType> hash_types = {};
 
     auto parse_args(int argc, char** argv) -> void {
         argparse::ArgumentParser program(fs::path(argv[0]).filename().generic_string());
@@ -32,6 +42,12 @@ struct Main {
             .help("Do not extract and verify chunk hash.")
             .default_value(false)
             .implicit_value(true);
+        program.add_argument("--hash-type")
+            .help("Hash type to try first: auto, sha512, sha256, hkdf, blake3.")
+            .default_value(std::string("auto"));
+        program.add_argument("--manifest")
+            .help("Manifest to take chunk hash types from.")
+            .default_value(std::string(""));
         program.add_argument("--no-progress")
             .help("Do not print progress to cerr.")
             .default_value(false)
@@ -52,6 +68,12 @@ struct Main {
             .action([](std::string const& value) -> std::uint32_t {
                 return std::clamp((std::uint32_t)std::stoul(value), 0u, 4096u);
             });
+        program.add_argument("--threads")
+            .help("Number of threads used to verify and recompress chunks(0 for all cores) [0, 256]")
+            .default_value(std::uint32_t{1})
+            .action([](std::string const& value) -> std::uint32_t {
+                return std::clamp((std::uint32_t)std::stoul(value), 0u, 256u);
+            });
 
         program.parse_args(argc, argv);
 
@@ -65,6 +87,12 @@ struct Main {
         cli.level_recompress = program.get<std::int32_t>("--level-recompress");
         cli.no_extract = program.get<bool>("--no-extract");
         cli.no_progress = program.get<bool>("--no-progress");
+        cli.hash_type = RChunk::hash_type_parse(program.get<std::string>("--hash-type"));
+        cli.manifest = program.get<std::string>("--manifest");
+        cli.threads = program.get<std::uint32_t>("--threads");
+        if (!cli.threads) {
+            cli.threads = ThreadPool::hardware_threads();
+        }
     }
 
     auto run() {
@@ -75,42 +103,67 @@ struct Main {
         }
         std::cerr << "Processing output bundle ... " << std::endl;
         auto output = RCache(cli.output);
+        auto pool = ThreadPool(cli.threads);
+        if (!cli.manifest.empty()) {
+            std::cerr << "Reading manifest hash types ... " << std::endl;
+            hash_types = RFile::read_hash_types(cli.manifest);
+        }
         std::cerr << "Processing input bundles ... " << std::endl;
         for (std::uint32_t index = paths.size(); auto const& path : paths) {
-            add_bundle(path, output, index--);
+            add_bundle(path, output, pool, index--);
         }
     }
 
-    auto add_bundle(fs::path const& path, RCache& output, std::uint32_t index) -> void {
+    auto add_bundle(fs::path const& path, RCache& output, ThreadPool& pool, std::uint32_t index) -> void {
         try {
             rlib_trace("path: %s", path.generic_string().c_str());
             std::cout << "START:" << path.filename().generic_string() << std::endl;
-            auto infile = IO::File(path, IO::READ);
+            auto infile = IO::File(path, IO::READ | IO::SEQUENTIAL);
             auto bundle = RBUN::read(infile, true);
             {
                 std::uint64_t offset = 0;
                 progress_bar p("MERGED", cli.no_progress, index, offset, bundle.toc_offset);
-                for (auto const& chunk : bundle.chunks) {
-                    if (!output.contains(chunk.chunkId)) {
-                        auto src = infile.copy(offset, chunk.compressed_size);
-                        if (cli.level_recompress) {
-                            auto dst = zstd_decompress(src, chunk.uncompressed_size);
-                            auto hash_type = RChunk::hash_type(dst, chunk.chunkId);
-                            rlib_assert(hash_type != HashType::None);
-                            output.add_uncompressed(dst, cli.level_recompress, hash_type);
-                        } else if (!cli.no_extract) {
-                            auto dst = zstd_decompress(src, chunk.uncompressed_size);
-                            auto hash_type = RChunk::hash_type(dst, chunk.chunkId);
-                            rlib_assert(hash_type != HashType::None);
-                            output.add(chunk, src);
-                        } else {
-                            rlib_assert(zstd_frame_decompress_size(src) == chunk.uncompressed_size);
-                            output.add(chunk, src);
+                // Extract on pool but append in order so output does not depend on thread count.
+                auto pending = std::deque<std::pair<std::uint64_t, std::future<RCache::Compressed>>>{};
+                auto const max_pending = std::max(pool.size(), 1u) * 8;
+                auto consumed = std::uint64_t{};
+                // shared by tasks of this bundle, a stale read only costs extra detection
+                auto last = std::atomic<HashType>(HashType::RITO_HKDF);
+                if (cli.hash_type != HashType::None) {
+                    last = cli.hash_type;
+                }
+                auto commit = [&] {
+                    auto [end, result] = std::move(pending.front());
+                    pending.pop_front();
+                    output.add_compressed(result.get());
+                    p.update(end);
+                    // input is read once, drop it from page cache once every chunk before end was merged
+                    infile.dont_need(consumed, end - consumed);
+                    consumed = end;
+                };
+                try {
+                    for (auto const& chunk : bundle.chunks) {
+                        if (!output.contains(chunk.chunkId)) {
+                            pending.emplace_back(offset + chunk.compressed_size, pool.submit([&, chunk, offset] {
+                                return extract_chunk(infile, output, chunk, offset, last);
+                            }));
+                            while (pending.size() > max_pending) {
+                                commit();
+                            }
                         }
+                        offset += chunk.compressed_size;
+                    }
+                    while (!pending.empty()) {
+                        commit();
+                    }
+                } catch (std::exception const&) {
+                    // tasks still reference infile, let them finish before unwinding
+                    for (auto& [end, result] : pending) {
+                        result.wait();
                     }
-                    offset += chunk.compressed_size;
-                    p.update(offset);
+                    throw;
                 }
+                p.update(offset);
             }
             std::cout << " OK!" << std::endl;
         } catch (std::exception const& e) {
@@ -122,6 +175,36 @@ struct Main {
             error_stack().clear();
         }
     }
+
+    // Type from manifest when it knows the chunk, otherwise whatever matched last in this bundle.
+    auto hash_type_hint(ChunkID chunkId, HashType last) const -> HashType {
+        if (auto i = hash_types.find(chunkId); i != hash_types.end()) {
+            return i->second;
+        }
+        return last;
+    }
+
+    auto extract_chunk(IO const& infile,
+                       RCache const& output,
+                       RChunk const& chunk,
+                       std::uint64_t offset,
+                       std::atomic<HashType>& last) const -> RCache::Compressed {
+        auto src = infile.copy(offset, chunk.compressed_size);
+        if (cli.level_recompress || !cli.no_extract) {
+            auto dst = zstd_decompress(src, chunk.uncompressed_size);
+            auto hash_type = RChunk::hash_type(dst, chunk.chunkId, hash_type_hint(chunk.chunkId, last));
+            rlib_assert(hash_type != HashType::None);
+            last = hash_type;
+            if (cli.level_recompress) {
+                return output.compress(dst, cli.level_recompress, hash_type);
+            }
+        } else {
+            rlib_assert(zstd_frame_decompress_size(src) == chunk.uncompressed_size);
+        }
+        auto result = RCache::Compressed{.chunk = chunk};
+        rlib_assert(result.data.append(src));
+        return result;
+    }
 };
 
 int main(int argc, char** argv) {
@@ -29,8 +29,9 @@ struct Main {
         auto paths = rlib::collect_files(cli.inputs, [](fs::path const& p) { return p.extension() == ".manifest"; });
         for (auto const& path : paths) {
             rlib_trace("Manifest file: %s", path.generic_string().c_str());
-            auto manifest = RMAN::read_file(path);
-            for (auto const& bundle : manifest.bundles) {
+            auto infile = IO::MMap(path, IO::READ);
+            auto manifest = RMAN::View(infile.copy(0, infile.size()));
+            for (auto const& bundle : manifest.bundles()) {
                 fmt::dynamic_format_arg_store<fmt::format_context> store{};
                 store.push_back(fmt::arg("bundleId", bundle.bundleId));
                 std::cout << fmt::vformat(cli.format, store) << std::endl;
@@ -1,26 +1,64 @@
 #include <argparse.hpp>
+#include <deque>
+#include <future>
 #include <iostream>
+#include <rlib/buffer.hpp>
 #include <rlib/common.hpp>
 #include <rlib/iofile.hpp>
 #include <rlib/rcdn.hpp>
 #include <rlib/rfile.hpp>
+#include <rlib/threadpool.hpp>
 
 using namespace rlib;
 
 struct Main {
+    // Files verified ahead of one being downloaded, each of them reads up to 32MiB batch at time.
+    static constexpr std::uint32_t VERIFY_AHEAD = 8;
+
     struct CLI {
         std::string manifest = {};
         std::string updatefrommanfiest = {};
         std::string output = {};
         bool no_verify = {};
+        std::uint32_t verify_threads = {};
         bool no_write = {};
         bool no_progress = {};
+        std::uint32_t batch = {};
+        bool preallocate = {};
+        std::size_t sort_writes = {};
+        bool cdn_stats = {};
         RFile::Match match = {};
         RCache::Options cache = {};
         RCDN::Options cdn = {};
     } cli = {};
     std::unique_ptr<RCache> cache = {};
     std::unique_ptr<RCDN> cdn = {};
+    std::unique_ptr<ThreadPool> verify_file_pool = {};
+    std::unique_ptr<ThreadPool> verify_hash_pool = {};
+
+    struct Verified {
+        std::vector<RChunk::Dst> bad_chunks;
+        std::uint64_t done;
+    };
+
+    // File waiting for its chunks, offsets of chunks are shifted by base so files in batch do not overlap.
+    struct Pending {
+        struct Write {
+            std::uint64_t offset;
+            Buffer data;
+        };
+        RFile const* rfile;
+        fs::path path;
+        std::uint32_t index;
+        std::uint64_t base;
+        std::size_t remaining;
+        std::unique_ptr<IO::File> outfile;
+        std::vector<Write> writes = {};
+    };
+    std::vector<Pending> batch = {};
+    std::vector<RChunk::Dst> batch_chunks = {};
+    std::uint64_t batch_end = {};
+    std::size_t batch_staged = {};
 
     auto parse_args(int argc, char** argv) -> void {
         argparse::ArgumentParser program(fs::path(argv[0]).filename().generic_string());
@@ -32,22 +70,22 @@ struct Main {
             .default_value(std::string("."));
         program.add_argument("-l", "--filter-lang")
             .help("Filter by language(none for international files) with regex match.")
-            .default_value(std::optional<std::regex>{})
-            .action([](std::string const& value) -> std::optional<std::regex> {
+            .default_value(std::optional<Pattern>{})
+            .action([](std::string const& value) -> std::optional<Pattern> {
                 if (value.empty()) {
                     return std::nullopt;
                 } else {
-                    return std::regex{value, std::regex::optimize | std::regex::icase};
+                    return Pattern{value};
                 }
             });
         program.add_argument("-p", "--filter-path")
             .help("Filter by path with regex match.")
-            .default_value(std::optional<std::regex>{})
-            .action([](std::string const& value) -> std::optional<std::regex> {
+            .default_value(std::optional<Pattern>{})
+            .action([](std::string const& value) -> std::optional<Pattern> {
                 if (value.empty()) {
                     return std::nullopt;
                 } else {
-                    return std::regex{value, std::regex::optimize | std::regex::icase};
+                    return Pattern{value};
                 }
             });
         program.add_argument("-u", "--update")
@@ -57,8 +95,30 @@ struct Main {
             .help("Force force full without verify.")
             .default_value(false)
             .implicit_value(true);
+        program.add_argument("--verify-threads")
+            .help("Number of threads used to verify existing files(0 for all cores) [0, 256]")
+            .default_value(std::uint32_t{0})
+            .action([](std::string const& value) -> std::uint32_t {
+                return std::clamp((std::uint32_t)std::stoul(value), 0u, 256u);
+            });
         program.add_argument("--no-write").help("Do not write to file.").default_value(false).implicit_value(true);
         program.add_argument("--no-progress").help("Do not print progress.").default_value(false).implicit_value(true);
+        program.add_argument("--batch")
+            .help("Number of files to download together [1, 512]")
+            .default_value(std::uint32_t{64})
+            .action([](std::string const& value) -> std::uint32_t {
+                return std::clamp((std::uint32_t)std::stoul(value), 1u, 512u);
+            });
+        program.add_argument("--preallocate")
+            .help("Allocate whole output file before writing to it.")
+            .default_value(false)
+            .implicit_value(true);
+        program.add_argument("--sort-writes")
+            .help("Hold up to this many megabytes of chunks to write them in file order, 0 to disable [0, 4096]")
+            .default_value(std::uint32_t{0})
+            .action([](std::string const& value) -> std::uint32_t {
+                return std::clamp((std::uint32_t)std::stoul(value), 0u, 4096u);
+            });
 
         // Cache options
         program.add_argument("--cache").help("Cache file path.").default_value(std::string{""});
@@ -70,6 +130,10 @@ struct Main {
             .help("Force create new part regardless of size.")
             .default_value(false)
             .implicit_value(true);
+        program.add_argument("--cache-folder-index")
+            .help("Write index into bundle folder cache so it starts up faster next time.")
+            .default_value(false)
+            .implicit_value(true);
         program.add_argument("--cache-buffer")
             .help("Size for cache buffer in megabytes [1, 4096]")
             .default_value(std::uint32_t{32})
@@ -107,11 +171,33 @@ struct Main {
             .action([](std::string const& value) -> std::uint32_t {
                 return std::clamp((std::uint32_t)std::stoul(value), 1u, 64u);
             });
+        program.add_argument("--cdn-merge-gap")
+            .help("Largest unused gap in killobytes to download when merging ranges [0, 65536].")
+            .default_value(std::size_t{0})
+            .action([](std::string const& value) -> std::size_t {
+                return std::clamp((std::size_t)std::stoul(value), std::size_t{0}, std::size_t{65536});
+            });
+        program.add_argument("--cdn-max-range")
+            .help("Largest range in megabytes for merged chunks, 0 for no limit [0, 4096].")
+            .default_value(std::size_t{0})
+            .action([](std::string const& value) -> std::size_t {
+                return std::clamp((std::size_t)std::stoul(value), std::size_t{0}, std::size_t{4096});
+            });
+        program.add_argument("--cdn-threads")
+            .help("Number of threads used to decompress downloaded chunks(0 for all cores) [0, 256]")
+            .default_value(std::uint32_t{0})
+            .action([](std::string const& value) -> std::uint32_t {
+                return std::clamp((std::uint32_t)std::stoul(value), 0u, 256u);
+            });
         program.add_argument("--cdn-interval")
-            .help("Curl poll interval in miliseconds.")
+            .help("Curl longest time to wait for socket activity in miliseconds.")
             .default_value(int{100})
             .action([](std::string const& value) -> int { return std::clamp((int)std::stoul(value), 0, 30000); });
         program.add_argument("--cdn-verbose").help("Curl: verbose logging.").default_value(false).implicit_value(true);
+        program.add_argument("--cdn-stats")
+            .help("Print request latency histogram at the end.")
+            .default_value(false)
+            .implicit_value(true);
         program.add_argument("--cdn-buffer")
             .help("Curl buffer size in killobytes [1, 512].")
             .default_value(long{512})
@@ -131,10 +217,18 @@ struct Main {
         cli.updatefrommanfiest = program.get<std::string>("--update");
 
         cli.no_verify = program.get<bool>("--no-verify");
+        cli.verify_threads = program.get<std::uint32_t>("--verify-threads");
+        if (!cli.verify_threads) {
+            cli.verify_threads = ThreadPool::hardware_threads();
+        }
         cli.no_write = program.get<bool>("--no-write");
         cli.no_progress = program.get<bool>("--no-progress");
-        cli.match.langs = program.get<std::optional<std::regex>>("--filter-lang");
-        cli.match.path = program.get<std::optional<std::regex>>("--filter-path");
+        cli.batch = program.get<std::uint32_t>("--batch");
+        cli.preallocate = program.get<bool>("--preallocate");
+        cli.sort_writes = program.get<std::uint32_t>("--sort-writes") * MiB;
+        cli.cdn_stats = program.get<bool>("--cdn-stats");
+        cli.match.langs = program.get<std::optional<Pattern>>("--filter-lang");
+        cli.match.path = program.get<std::optional<Pattern>>("--filter-path");
 
         cli.cache = {
             .path = program.get<std::string>("--cache"),
@@ -142,8 +236,10 @@ struct Main {
             .newonly = program.get<bool>("--cache-newonly"),
             .flush_size = program.get<std::uint32_t>("--cache-buffer") * MiB,
             .max_size = program.get<std::uint32_t>("--cache-limit") * GiB,
+            .folder_index = program.get<bool>("--cache-folder-index"),
         };
 
+        auto cdn_threads = program.get<std::uint32_t>("--cdn-threads");
         cli.cdn = {
             .url = clean_path(program.get<std::string>("--cdn")),
             .verbose = program.get<bool>("--cdn-verbose"),
@@ -157,6 +253,9 @@ struct Main {
             .cookielist = program.get<std::string>("--cdn-cookielist"),
             .low_speed_limit = program.get<std::size_t>("--cdn-lowspeed-limit") * KiB,
             .low_speed_time = program.get<std::size_t>("--cdn-lowspeed-time"),
+            .merge_gap = program.get<std::size_t>("--cdn-merge-gap") * KiB,
+            .max_range = program.get<std::size_t>("--cdn-max-range") * MiB,
+            .threads = cdn_threads ? cdn_threads : ThreadPool::hardware_threads(),
         };
     }
 
@@ -180,6 +279,11 @@ struct Main {
 
         cdn = std::make_unique<RCDN>(cli.cdn, cache.get());
 
+        // files are read on one pool and their chunks hashed on other, reads waiting on hashes never starve them
+        auto const verify_threads = cli.no_verify ? 0u : cli.verify_threads;
+        verify_file_pool = std::make_unique<ThreadPool>(std::min(verify_threads, VERIFY_AHEAD));
+        verify_hash_pool = std::make_unique<ThreadPool>(verify_threads);
+
         auto skipids = std::unordered_map<std::string, FileID>{};
         if (!cli.updatefrommanfiest.empty()) {
             rlib_trace("Update from file: %s", cli.updatefrommanfiest.c_str());
@@ -201,65 +305,202 @@ struct Main {
             }
             return true;
         });
-        for (std::uint32_t index = files.size(); auto const& rfile : files) {
-            download_file(rfile, index--);
+        auto verified = std::deque<std::future<Verified>>{};
+        try {
+            for (std::size_t next = 0, i = 0; i != files.size(); ++i) {
+                // results are taken in manifest order no matter which file finished verifying first
+                for (; next != files.size() && next < i + VERIFY_AHEAD; ++next) {
+                    verified.push_back(verify_file(files[next]));
+                }
+                auto result = verified.front().get();
+                verified.pop_front();
+                prepare_file(files[i], std::move(result), (std::uint32_t)(files.size() - i));
+                if (batch.size() >= cli.batch) {
+                    download_batch();
+                }
+            }
+        } catch (std::exception const&) {
+            // tasks still reference files, let them finish before unwinding
+            for (auto& result : verified) {
+                result.wait();
+            }
+            throw;
+        }
+        download_batch();
+
+        if (cli.cdn_stats) {
+            print_stats();
         }
     }
 
-    auto download_file(RFile const& rfile, std::uint32_t index) -> void {
-        std::cout << "START: " << rfile.path << std::endl;
-        auto path = fs::path(cli.output) / rfile.path;
-        rlib_trace("Path: %s", path.generic_string().c_str());
-        auto done = std::uint64_t{};
-        auto bad_chunks = std::vector<RChunk::Dst>{};
+    auto print_stats() -> void {
+        auto const& stats = cdn->stats();
+        std::cout << fmt::format("REQUESTS: {} FAILED: {}", stats.requests, stats.failed) << std::endl;
+        if (!stats.error.empty()) {
+            std::cout << fmt::format("LAST ERROR: {}", stats.error) << std::endl;
+        }
+        for (std::size_t i = 0; i != stats.latency.size(); ++i) {
+            if (!stats.latency[i]) {
+                continue;
+            }
+            if (i == stats.latency.size() - 1) {
+                std::cout << fmt::format("LATENCY >={}ms: {}", 1ull << (i - 1), stats.latency[i]) << std::endl;
+            } else {
+                std::cout << fmt::format("LATENCY <{}ms: {}", 1ull << i, stats.latency[i]) << std::endl;
+            }
+        }
+    }
 
+    // Chunk list is resolved on calling thread, reading and hashing existing file runs on verify pools.
+    auto verify_file(RFile const& rfile) -> std::future<Verified> {
+        auto chunks = std::vector<RChunk::Dst>{};
         if (!rfile.chunks) {
             if (rfile.size) {
                 rlib_assert(cache.get());
-                bad_chunks = cache->get_chunks(rfile.fileId);
-                rlib_assert(!bad_chunks.empty());
+                chunks = cache->get_chunks(rfile.fileId);
+                rlib_assert(!chunks.empty());
             }
         } else {
-            bad_chunks = *rfile.chunks;
+            chunks = *rfile.chunks;
         }
+        auto path = fs::path(cli.output) / rfile.path;
+        return verify_file_pool->submit([this, path = std::move(path), chunks = std::move(chunks)]() mutable {
+            auto done = std::uint64_t{};
+            if (!cli.no_verify && !chunks.empty()) {
+                auto const on_good = [&](RChunk::Dst const& chunk, std::span<char const> data) {
+                    done += chunk.uncompressed_size;
+                };
+                RChunk::Dst::verify(path, chunks, on_good, verify_hash_pool.get());
+            }
+            return Verified{std::move(chunks), done};
+        });
+    }
 
-        if (!cli.no_verify && !bad_chunks.empty()) {
-            progress_bar p("VERIFIED", cli.no_progress, index, done, rfile.size);
-            RChunk::Dst::verify(path, bad_chunks, [&](RChunk::Dst const& chunk, std::span<char const> data) {
-                done += chunk.uncompressed_size;
-                p.update(done);
-            });
+    auto prepare_file(RFile const& rfile, Verified verified, std::uint32_t index) -> void {
+        auto path = fs::path(cli.output) / rfile.path;
+        rlib_trace("Path: %s", path.generic_string().c_str());
+        auto bad_chunks = std::move(verified.bad_chunks);
+
+        if (!cli.no_verify && rfile.size) {
+            progress_bar p("VERIFIED", cli.no_progress, index, 0, rfile.size);
+            p.update(verified.done);
         }
 
         auto outfile = std::unique_ptr<IO::File>();
         if (!cli.no_write) {
-            outfile = std::make_unique<IO::File>(path, IO::WRITE);
+            outfile = std::make_unique<IO::File>(path, cli.preallocate ? IO::WRITE | IO::PREALLOCATE : IO::WRITE);
+            rlib_assert(outfile->reserve(0, rfile.size));
             rlib_assert(outfile->resize(0, rfile.size));
         }
 
-        if (!bad_chunks.empty() && cdn) {
-            progress_bar p("DOWNLOAD", cli.no_progress, index, done, rfile.size);
-            bad_chunks = cdn->get(std::move(bad_chunks), [&](RChunk::Dst const& chunk, std::span<char const> data) {
-                if (outfile) {
-                    rlib_assert(outfile->write(chunk.uncompressed_offset, data));
-                }
-                done += chunk.uncompressed_size;
-                p.update(done);
+        if (bad_chunks.empty()) {
+            finish_file(rfile, path, std::move(outfile));
+            report_file(rfile, true);
+            return;
+        }
+
+        // chunks of all files in batch are fetched together so shared bundle ranges are only requested once
+        auto const base = batch_end;
+        batch_end += rfile.size + 1;
+        for (auto& chunk : bad_chunks) {
+            chunk.uncompressed_offset += base;
+        }
+        batch_chunks.insert(batch_chunks.end(), bad_chunks.begin(), bad_chunks.end());
+        batch.push_back(Pending{
+            .rfile = &rfile,
+            .path = std::move(path),
+            .index = index,
+            .base = base,
+            .remaining = bad_chunks.size(),
+            .outfile = std::move(outfile),
+        });
+    }
+
+    auto download_batch() -> void {
+        if (batch.empty()) {
+            return;
+        }
+        auto find_pending = [this](std::uint64_t offset) -> Pending& {
+            auto i = std::upper_bound(batch.begin(), batch.end(), offset, [](std::uint64_t value, auto const& file) {
+                return value < file.base;
             });
+            rlib_assert(i != batch.begin());
+            return *--i;
+        };
+        auto done = std::uint64_t{};
+        auto total = std::uint64_t{};
+        for (auto const& chunk : batch_chunks) {
+            total += chunk.uncompressed_size;
+        }
+        {
+            progress_bar p("DOWNLOAD", cli.no_progress, batch.back().index, done, total);
+            batch_chunks =
+                cdn->get(std::move(batch_chunks), [&](RChunk::Dst const& chunk, std::span<char const> data) {
+                    auto& file = find_pending(chunk.uncompressed_offset);
+                    if (file.outfile && cli.sort_writes) {
+                        auto buffer = Buffer{};
+                        rlib_assert(buffer.append(data));
+                        file.writes.push_back({chunk.uncompressed_offset - file.base, std::move(buffer)});
+                        batch_staged += data.size();
+                    } else if (file.outfile) {
+                        rlib_assert(file.outfile->write(chunk.uncompressed_offset - file.base, data));
+                    }
+                    if (!--file.remaining) {
+                        flush_writes(file);
+                        finish_file(*file.rfile, file.path, std::move(file.outfile));
+                        report_file(*file.rfile, true);
+                    } else if (batch_staged > cli.sort_writes) {
+                        for (auto& other : batch) {
+                            flush_writes(other);
+                        }
+                    }
+                    done += chunk.uncompressed_size;
+                    p.update(done);
+                });
+        }
+        for (auto& file : batch) {
+            flush_writes(file);
+        }
+        for (auto const& file : batch) {
+            if (file.remaining) {
+                report_file(*file.rfile, false);
+            }
+        }
+        batch.clear();
+        batch_chunks.clear();
+        batch_end = 0;
+    }
+
+    // Files of one batch finish out of order, both lines are printed together so each result follows its START.
+    auto report_file(RFile const& rfile, bool ok) -> void {
+        std::cout << "START: " << rfile.path << std::endl;
+        std::cout << (ok ? "OK!" : "FAIL!") << std::endl;
+    }
+
+    auto flush_writes(Pending& file) -> void {
+        if (file.writes.empty()) {
+            return;
         }
+        // writes that follow each other end up as one vectored write
+        sort_by<&Pending::Write::offset>(file.writes.begin(), file.writes.end());
+        auto ops = std::vector<IO::WriteOp>{};
+        ops.reserve(file.writes.size());
+        for (auto const& write : file.writes) {
+            ops.push_back({write.offset, write.data});
+            batch_staged -= write.data.size();
+        }
+        rlib_assert(file.outfile->write_batch(ops));
+        file.writes.clear();
+    }
 
-        if (!bad_chunks.empty()) {
-            std::cout << "FAIL!" << std::endl;
-        } else {
-            if (outfile) {
-                outfile = nullptr;
-                if (rfile.permissions & 01) {
-                    fs::permissions(path,
-                                    fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec,
-                                    fs::perm_options::add);
-                }
+    auto finish_file(RFile const& rfile, fs::path const& path, std::unique_ptr<IO::File> outfile) -> void {
+        if (outfile) {
+            outfile = nullptr;
+            if (rfile.permissions & 01) {
+                fs::permissions(path,
+                                fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec,
+                                fs::perm_options::add);
             }
-            std::cout << "OK!" << std::endl;
         }
     }
 };
@@ -24,22 +24,22 @@ struct Main {
 
         program.add_argument("-l", "--filter-lang")
             .help("Filter: language(none for international files).")
-            .default_value(std::optional<std::regex>{})
-            .action([](std::string const& value) -> std::optional<std::regex> {
+            .default_value(std::optional<Pattern>{})
+            .action([](std::string const& value) -> std::optional<Pattern> {
                 if (value.empty()) {
                     return std::nullopt;
                 } else {
-                    return std::regex{value, std::regex::optimize | std::regex::icase};
+                    return Pattern{value};
                 }
             });
         program.add_argument("-p", "--filter-path")
             .help("Filter: path with regex match.")
-            .default_value(std::optional<std::regex>{})
-            .action([](std::string const& value) -> std::optional<std::regex> {
+            .default_value(std::optional<Pattern>{})
+            .action([](std::string const& value) -> std::optional<Pattern> {
                 if (value.empty()) {
                     return std::nullopt;
                 } else {
-                    return std::regex{value, std::regex::optimize | std::regex::icase};
+                    return Pattern{value};
                 }
             });
 
@@ -47,8 +47,8 @@ struct Main {
 
         cli.format = program.get<std::string>("--format");
 
-        cli.match.langs = program.get<std::optional<std::regex>>("--filter-lang");
-        cli.match.path = program.get<std::optional<std::regex>>("--filter-path");
+        cli.match.langs = program.get<std::optional<Pattern>>("--filter-lang");
+        cli.match.path = program.get<std::optional<Pattern>>("--filter-path");
 
         cli.manifest = program.get<std::string>("manifest");
     }
@@ -3,12 +3,15 @@
 #include <fmt/format.h>
 
 #include <argparse.hpp>
+#include <deque>
+#include <future>
 #include <iostream>
 #include <rlib/ar.hpp>
 #include <rlib/common.hpp>
 #include <rlib/iofile.hpp>
 #include <rlib/rcache.hpp>
 #include <rlib/rmanifest.hpp>
+#include <rlib/threadpool.hpp>
 
 using namespace rlib;
 
@@ -24,9 +27,32 @@ struct Main {
         std::size_t chunk_size = 0;
         std::int32_t level = 0;
         std::int32_t level_high_entropy = 0;
+        std::size_t dict_size = 0;
+        std::uint32_t threads = 1;
         Ar ar = {};
     } cli = {};
 
+    struct Input {
+        fs::path path;
+        std::uint32_t index;
+        std::unique_ptr<IO::MMap> infile;
+        RFile rfile;
+    };
+
+    // Chunks are compressed out of order on the pool but always appended to bundle in input order,
+    // which keeps output identical to single threaded run.
+    // Each task hashes group of chunks together so their hkdf rounds can share simd lanes.
+    static constexpr std::size_t HASH_GROUP = 16;
+
+    struct Work {
+        std::shared_ptr<Input> input;
+        std::optional<Ar::Entry> entry;
+        std::shared_future<std::vector<RCache::Compressed>> result;
+        std::size_t index;
+    };
+    std::deque<Work> pending = {};
+    std::optional<progress_bar> progress = {};
+
     auto parse_args(int argc, char** argv) -> void {
         argparse::ArgumentParser program(fs::path(argv[0]).filename().generic_string());
         program.add_description("Lists bundle names used in manifest.");
@@ -78,6 +104,12 @@ struct Main {
             .action([](std::string const& value) -> std::int32_t {
                 return std::clamp((std::int32_t)std::stol(value), -7, 22);
             });
+        program.add_argument("--dict-size")
+            .help("Size of zstd dictionary trained from sampled chunks in kilobytes(0 to disable) [0, 1024]")
+            .default_value(std::uint32_t{0})
+            .action([](std::string const& value) -> std::uint32_t {
+                return std::clamp((std::uint32_t)std::stoul(value), 0u, 1024u);
+            });
         program.add_argument("--newonly")
             .help("Force create new part regardless of size.")
             .default_value(false)
@@ -94,6 +126,12 @@ struct Main {
             .action([](std::string const& value) -> std::uint32_t {
                 return std::clamp((std::uint32_t)std::stoul(value), 0u, 4096u);
             });
+        program.add_argument("--threads")
+            .help("Number of threads used to hash and compress chunks(0 for all cores) [0, 256]")
+            .default_value(std::uint32_t{1})
+            .action([](std::string const& value) -> std::uint32_t {
+                return std::clamp((std::uint32_t)std::stoul(value), 0u, 256u);
+            });
 
         program.parse_args(argc, argv);
 
@@ -114,6 +152,11 @@ struct Main {
         cli.strip_chunks = program.get<bool>("--strip-chunks");
         cli.level = program.get<std::int32_t>("--level");
         cli.level_high_entropy = program.get<std::int32_t>("--level-high-entropy");
+        cli.dict_size = program.get<std::uint32_t>("--dict-size") * KiB;
+        cli.threads = program.get<std::uint32_t>("--threads");
+        if (!cli.threads) {
+            cli.threads = ThreadPool::hardware_threads();
+        }
 
         cli.ar = Ar{
             .chunk_min = program.get<std::uint32_t>("--ar-min") * KiB,
@@ -134,22 +177,59 @@ struct Main {
         std::cerr << "Processing output bundle ... " << std::endl;
         auto outbundle = RCache(cli.outbundle);
 
+        if (cli.dict_size) {
+            std::cerr << "Training dictionary ... " << std::endl;
+            train_dict(paths, outbundle);
+        }
+
         std::cerr << "Create output manifest ..." << std::endl;
         auto writer = RFile::writer(cli.outmanifest, cli.append);
 
         std::cerr << "Processing input files ... " << std::endl;
+        auto pool = ThreadPool(cli.threads);
+        auto const max_pending = std::max(pool.size(), 1u) * HASH_GROUP * 2;
         for (std::uint32_t index = paths.size(); auto const& path : paths) {
-            auto file = add_file(path, outbundle, index--);
-            writer(std::move(file));
+            add_file(path, outbundle, pool, index--, [&] {
+                while (pending.size() > max_pending) {
+                    commit(outbundle, writer);
+                }
+            });
+        }
+        while (!pending.empty()) {
+            commit(outbundle, writer);
+        }
+    }
+
+    auto train_dict(std::vector<fs::path> const& paths, RCache& outbundle) const -> void {
+        auto samples = RCache::DictSamples{.dict_size = cli.dict_size};
+        // chunking is deterministic so samples are the same chunks that get compressed afterwards
+        auto const ar = cli.ar;
+        for (auto const& path : paths) {
+            if (samples.full()) {
+                break;
+            }
+            auto infile = IO::MMap(path, IO::READ);
+            ar(infile, [&](Ar::Entry const& entry) { samples.add(infile.copy(entry.offset, entry.size)); });
+        }
+        auto const dict = samples.train();
+        if (dict.empty()) {
+            std::cerr << "Not enough samples to train dictionary, compressing without one." << std::endl;
+            return;
         }
+        auto const dict_id = outbundle.set_dict(dict);
+        std::cerr << fmt::format("DICT: {:08X} from {} samples", dict_id, samples.sizes.size()) << std::endl;
     }
 
-    auto add_file(fs::path const& path, RCache& outbundle, std::uint32_t index) -> RFile {
-        std::cerr << "START: " << path << std::endl;
-        auto infile = IO::MMap(path, IO::READ);
-        auto rfile = RFile{};
-        rfile.size = infile.size();
-        rfile.langs = "none";
+    auto add_file(fs::path const& path,
+                  RCache& outbundle,
+                  ThreadPool& pool,
+                  std::uint32_t index,
+                  function_ref<void()> backpressure) -> void {
+        auto input = std::make_shared<Input>(Input{.path = path, .index = index});
+        input->infile = std::make_unique<IO::MMap>(path, IO::READ);
+        auto& rfile = input->rfile;
+        rfile.size = input->infile->size();
+        rfile.langs = {};
         rfile.path = fs_relative(path, cli.rootfolder);
         rfile.chunks = std::vector<RChunk::Dst>{};
         auto const status = fs::status(path);
@@ -158,22 +238,41 @@ struct Main {
             rfile.permissions = 1;
         }
         rfile.time = fs_get_time(path);
-        {
-            auto p = progress_bar("PROCESSED", cli.no_progress, index, 0, infile.size());
-            cli.ar(infile, [&](Ar::Entry const& entry) {
-                auto src = infile.copy(entry.offset, entry.size);
-                auto level = cli.level_high_entropy && entry.high_entropy ? cli.level_high_entropy : cli.level;
-                RChunk::Dst chunk = {outbundle.add_uncompressed(src, level)};
-                chunk.hash_type = HashType::RITO_HKDF;
-                rfile.chunks->push_back(chunk);
-                chunk.uncompressed_offset = entry.offset;
-                p.update(entry.offset + entry.size);
+        pending.push_back(Work{.input = input});
+        auto group = std::vector<std::pair<std::span<char const>, std::int32_t>>{};
+        auto const submit = [&] {
+            auto const count = group.size();
+            auto result = pool.submit([group = std::move(group), &outbundle] {
+                auto datas = std::vector<std::span<char const>>{};
+                for (auto const& [src, level] : group) {
+                    datas.push_back(src);
+                }
+                auto const ids = RChunk::hash_many(datas, HashType::RITO_HKDF);
+                auto compressed = std::vector<RCache::Compressed>{};
+                for (std::size_t i = 0; i != group.size(); ++i) {
+                    compressed.push_back(outbundle.compress(group[i].first, group[i].second, ids[i]));
+                }
+                return compressed;
             });
+            group.clear();
+            auto shared = result.share();
+            for (auto i = pending.size() - count; i != pending.size(); ++i) {
+                pending[i].result = shared;
+            }
+        };
+        cli.ar(*input->infile, [&](Ar::Entry const& entry) {
+            auto level = cli.level_high_entropy && entry.high_entropy ? cli.level_high_entropy : cli.level;
+            group.emplace_back(input->infile->copy(entry.offset, entry.size), level);
+            pending.push_back(Work{.input = input, .entry = entry, .index = group.size() - 1});
+            if (group.size() == HASH_GROUP) {
+                submit();
+                backpressure();
+            }
+        });
+        if (!group.empty()) {
+            submit();
         }
-        rfile.fileId = outbundle.add_chunks(*rfile.chunks);
-        if (cli.strip_chunks && rfile.chunks && rfile.chunks->size() > 1) {
-            rfile.chunks = std::nullopt;
-        }
+        pending.push_back(Work{.input = input});
         if (!cli.ar.errors.empty()) {
             std::cout << "Smart chunking failed for:\n";
             for (auto const& error : cli.ar.errors) {
@@ -182,7 +281,34 @@ struct Main {
             cli.ar.errors.clear();
             std::cout << std::flush;
         }
-        return rfile;
+    }
+
+    auto commit(RCache& outbundle, std::function<void(RFile&&)> const& writer) -> void {
+        auto work = std::move(pending.front());
+        pending.pop_front();
+        auto& input = *work.input;
+        auto& rfile = input.rfile;
+        if (!work.result.valid()) {
+            // First marker starts the file and second one finishes it
+            if (!progress) {
+                std::cerr << "START: " << input.path << std::endl;
+                progress.emplace("PROCESSED", cli.no_progress, input.index, 0, rfile.size);
+                return;
+            }
+            progress = std::nullopt;
+            rfile.fileId = outbundle.add_chunks(*rfile.chunks);
+            if (cli.strip_chunks && rfile.chunks && rfile.chunks->size() > 1) {
+                rfile.chunks = std::nullopt;
+            }
+            input.infile = nullptr;
+            writer(std::move(rfile));
+            return;
+        }
+        RChunk::Dst dst = {outbundle.add_compressed(work.result.get()[work.index])};
+        dst.hash_type = HashType::RITO_HKDF;
+        dst.uncompressed_offset = work.entry->offset;
+        rfile.chunks->push_back(dst);
+        progress->update(work.entry->offset + work.entry->size);
     }
 };
 
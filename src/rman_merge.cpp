@@ -58,22 +58,22 @@ struct Main {
         // Match options
         program.add_argument("-l", "--filter-lang")
             .help("Filter: language(none for international files).")
-            .default_value(std::optional<std::regex>{})
-            .action([](std::string const& value) -> std::optional<std::regex> {
+            .default_value(std::optional<Pattern>{})
+            .action([](std::string const& value) -> std::optional<Pattern> {
                 if (value.empty()) {
                     return std::nullopt;
                 } else {
-                    return std::regex{value, std::regex::optimize | std::regex::icase};
+                    return Pattern{value};
                 }
             });
         program.add_argument("-p", "--filter-path")
             .help("Filter: path with regex match.")
-            .default_value(std::optional<std::regex>{})
-            .action([](std::string const& value) -> std::optional<std::regex> {
+            .default_value(std::optional<Pattern>{})
+            .action([](std::string const& value) -> std::optional<Pattern> {
                 if (value.empty()) {
                     return std::nullopt;
                 } else {
-                    return std::regex{value, std::regex::optimize | std::regex::icase};
+                    return Pattern{value};
                 }
             });
 
@@ -93,8 +93,8 @@ struct Main {
         cli.strip_chunks = program.get<bool>("--strip-chunks");
         cli.with_prefix = program.get<bool>("--with-prefix");
 
-        cli.match.langs = program.get<std::optional<std::regex>>("--filter-lang");
-        cli.match.path = program.get<std::optional<std::regex>>("--filter-path");
+        cli.match.langs = program.get<std::optional<Pattern>>("--filter-lang");
+        cli.match.path = program.get<std::optional<Pattern>>("--filter-path");
     }
 
     auto run() -> void {
@@ -110,9 +110,9 @@ struct Main {
         auto writer = RFile::writer(cli.output);
 
         std::cerr << "Processing input files ... " << std::endl;
-        for (auto const& path : paths) {
+        RFile::read_files(paths, [&, this](fs::path const& path, std::vector<RFile>& files) {
             auto const name = path.filename().replace_extension("").generic_string() + '/';
-            RFile::read_file(path, [&, this](RFile& rfile) {
+            for (auto& rfile : files) {
                 if (this->cli.with_prefix) {
                     rfile.path.insert(rfile.path.begin(), name.begin(), name.end());
                 }
@@ -120,9 +120,8 @@ struct Main {
                     process_file(rfile);
                     writer(std::move(rfile));
                 }
-                return true;
-            });
-        }
+            }
+        });
     }
 
     void process_file(RFile& rfile) {
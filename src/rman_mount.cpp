@@ -5,17 +5,24 @@
 #include <sys/stat.h>
 
 #include <argparse.hpp>
+#include <atomic>
 #include <chrono>
 #include <cinttypes>
 #include <compare>
+#include <condition_variable>
 #include <cstring>
 #include <ctime>
+#include <deque>
+#include <mutex>
+#include <rlib/chunkcache.hpp>
 #include <rlib/common.hpp>
 #include <rlib/iofile.hpp>
 #include <rlib/rcache.hpp>
 #include <rlib/rcdn.hpp>
 #include <rlib/rdir.hpp>
 #include <rlib/rfile.hpp>
+#include <thread>
+#include <unordered_set>
 
 #ifdef _WIN32
 #    define S_IFLNK 0120000
@@ -31,6 +38,110 @@
 
 using namespace rlib;
 
+// Downloads chunks ahead of sequential readers on a background thread into memory cache.
+struct Prefetch {
+    Prefetch(RCDN *cdn, ChunkCache *mem_cache) noexcept : cdn_(cdn), mem_cache_(mem_cache) {}
+    Prefetch(Prefetch const &) = delete;
+    ~Prefetch() noexcept {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    auto push(std::span<RChunk::Dst const> chunks) -> void {
+        auto batch = std::vector<RChunk::Dst>{};
+        {
+            std::lock_guard lock(mutex_);
+            for (auto const &chunk : chunks) {
+                // memory cache drops chunks bigger than its shard, readers would only wait to download them again
+                if (chunk.uncompressed_size > mem_cache_->max_chunk_size()) {
+                    continue;
+                }
+                if (mem_cache_->contains(chunk.chunkId) || !inflight_.insert(chunk.chunkId).second) {
+                    continue;
+                }
+                batch.push_back(chunk);
+            }
+            if (batch.empty()) {
+                return;
+            }
+            queue_.push_back(std::move(batch));
+            if (!thread_.joinable()) {
+                thread_ = std::thread([this] { this->run(); });
+            }
+        }
+        cv_.notify_all();
+    }
+
+    // Blocks until chunk that is being prefetched lands in memory cache, returns false when request got interrupted.
+    auto wait(ChunkID chunkId) -> bool {
+        std::unique_lock lock(mutex_);
+        while (!cv_.wait_for(lock, std::chrono::milliseconds{100}, [&, this] {
+            return stop_ || !inflight_.contains(chunkId);
+        })) {
+            if (fuse_interrupted()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    RCDN *cdn_;
+    ChunkCache *mem_cache_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::vector<RChunk::Dst>> queue_;
+    std::unordered_set<ChunkID> inflight_;
+    std::thread thread_;
+    bool stop_ = {};
+
+    auto run() noexcept -> void {
+        for (;;) {
+            auto batch = std::vector<RChunk::Dst>{};
+            {
+                std::unique_lock lock(mutex_);
+                cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+                if (stop_) {
+                    return;
+                }
+                // merge everything queued so far, RCDN coalesces neighbouring ranges into one request
+                for (; !queue_.empty(); queue_.pop_front()) {
+                    batch.insert(batch.end(), queue_.front().begin(), queue_.front().end());
+                }
+            }
+            try {
+                cdn_->get(batch, [this](RChunk::Dst const &chunk, std::span<char const> data) {
+                    auto buffer = std::make_shared<Buffer>();
+                    rlib_assert(buffer->append(data));
+                    mem_cache_->put(chunk.chunkId, std::move(buffer));
+                    {
+                        std::lock_guard lock(mutex_);
+                        inflight_.erase(chunk.chunkId);
+                    }
+                    cv_.notify_all();
+                });
+            } catch (std::exception const &) {
+                // readers will fetch whatever is missing on their own
+                error_stack().clear();
+            }
+            {
+                // release chunks that failed to download
+                std::lock_guard lock(mutex_);
+                for (auto const &chunk : batch) {
+                    inflight_.erase(chunk.chunkId);
+                }
+            }
+            cv_.notify_all();
+        }
+    }
+};
+
 struct Main {
     struct CLI {
         std::string output = {};
@@ -39,10 +150,14 @@ struct Main {
         std::vector<std::string> manifests = {};
         RFile::Match match = {};
         bool with_prefix = {};
+        std::size_t mem_cache = {};
+        std::uint32_t readahead = {};
     } cli = {};
     fuse_args fargs = {};
     std::unique_ptr<RCache> cache = {};
     std::unique_ptr<RCDN> cdn = {};
+    std::unique_ptr<ChunkCache> mem_cache = {};
+    std::unique_ptr<Prefetch> prefetch = {};
     std::unique_ptr<RDirEntry> root = {};
 
     auto parse_args(int argc, char **argv) -> void {
@@ -63,22 +178,22 @@ struct Main {
         // Filter options
         program.add_argument("-l", "--filter-lang")
             .help("Filter by language(none for international files) with regex match.")
-            .default_value(std::optional<std::regex>{})
-            .action([](std::string const &value) -> std::optional<std::regex> {
+            .default_value(std::optional<Pattern>{})
+            .action([](std::string const &value) -> std::optional<Pattern> {
                 if (value.empty()) {
                     return std::nullopt;
                 } else {
-                    return std::regex{value, std::regex::optimize | std::regex::icase};
+                    return Pattern{value};
                 }
             });
         program.add_argument("-p", "--filter-path")
             .help("Filter by path with regex match.")
-            .default_value(std::optional<std::regex>{})
-            .action([](std::string const &value) -> std::optional<std::regex> {
+            .default_value(std::optional<Pattern>{})
+            .action([](std::string const &value) -> std::optional<Pattern> {
                 if (value.empty()) {
                     return std::nullopt;
                 } else {
-                    return std::regex{value, std::regex::optimize | std::regex::icase};
+                    return Pattern{value};
                 }
             });
 
@@ -92,6 +207,10 @@ struct Main {
             .help("Force create new part regardless of size.")
             .default_value(false)
             .implicit_value(true);
+        program.add_argument("--cache-folder-index")
+            .help("Write index into bundle folder cache so it starts up faster next time.")
+            .default_value(false)
+            .implicit_value(true);
         program.add_argument("--cache-buffer")
             .help("Size for cache buffer in megabytes [1, 4096]")
             .default_value(std::uint32_t{32})
@@ -105,6 +224,19 @@ struct Main {
                 return std::clamp((std::uint32_t)std::stoul(value), 0u, 4096u);
             });
 
+        program.add_argument("--mem-cache")
+            .help("Size for in memory cache of decompressed chunks in megabytes [0, 65536]")
+            .default_value(std::uint32_t{256})
+            .action([](std::string const &value) -> std::uint32_t {
+                return std::clamp((std::uint32_t)std::stoul(value), 0u, 65536u);
+            });
+        program.add_argument("--readahead")
+            .help("Number of chunks to prefetch for sequential reads, needs memory cache [0, 256]")
+            .default_value(std::uint32_t{16})
+            .action([](std::string const &value) -> std::uint32_t {
+                return std::clamp((std::uint32_t)std::stoul(value), 0u, 256u);
+            });
+
         // CDN options
         program.add_argument("--cdn")
             .help("Source url to download files from.")
@@ -117,6 +249,22 @@ struct Main {
             .help("Curl average transfer speed in killobytes per second that the transfer should be above.")
             .default_value(std::size_t{64})
             .action([](std::string const &value) -> std::size_t { return (std::size_t)std::stoul(value); });
+        program.add_argument("--cdn-retry")
+            .help("Number of retries to download from url.")
+            .default_value(std::uint32_t{3})
+            .action([](std::string const &value) -> std::uint32_t {
+                return std::clamp((std::uint32_t)std::stoul(value), 0u, 8u);
+            });
+        program.add_argument("--cdn-workers")
+            .default_value(std::uint32_t{8})
+            .help("Number of connections used for prefetching.")
+            .action([](std::string const &value) -> std::uint32_t {
+                return std::clamp((std::uint32_t)std::stoul(value), 1u, 64u);
+            });
+        program.add_argument("--cdn-interval")
+            .help("Curl longest time to wait for socket activity in miliseconds.")
+            .default_value(int{100})
+            .action([](std::string const &value) -> int { return std::clamp((int)std::stoul(value), 0, 30000); });
         program.add_argument("--cdn-verbose").help("Curl: verbose logging.").default_value(false).implicit_value(true);
         program.add_argument("--cdn-buffer")
             .help("Curl buffer size in killobytes [1, 512].")
@@ -134,9 +282,11 @@ struct Main {
 
         cli.output = program.get<std::string>("output");
         cli.manifests = program.get<std::vector<std::string>>("manifests");
-        cli.match.langs = program.get<std::optional<std::regex>>("--filter-lang");
-        cli.match.path = program.get<std::optional<std::regex>>("--filter-path");
+        cli.match.langs = program.get<std::optional<Pattern>>("--filter-lang");
+        cli.match.path = program.get<std::optional<Pattern>>("--filter-path");
         cli.with_prefix = program.get<bool>("--with-prefix");
+        cli.mem_cache = program.get<std::uint32_t>("--mem-cache") * MiB;
+        cli.readahead = program.get<std::uint32_t>("--readahead");
 
         cli.cache = {
             .path = program.get<std::string>("--cache"),
@@ -144,12 +294,16 @@ struct Main {
             .newonly = program.get<bool>("--cache-newonly"),
             .flush_size = program.get<std::uint32_t>("--cache-buffer") * MiB,
             .max_size = program.get<std::uint32_t>("--cache-limit") * GiB,
+            .folder_index = program.get<bool>("--cache-folder-index"),
         };
 
         cli.cdn = {
             .url = clean_path(program.get<std::string>("--cdn")),
             .verbose = program.get<bool>("--cdn-verbose"),
             .buffer = program.get<long>("--cdn-buffer"),
+            .interval = program.get<int>("--cdn-interval"),
+            .retry = program.get<std::uint32_t>("--cdn-retry"),
+            .workers = program.get<std::uint32_t>("--cdn-workers"),
             .proxy = program.get<std::string>("--cdn-proxy"),
             .useragent = program.get<std::string>("--cdn-useragent"),
             .cookiefile = program.get<std::string>("--cdn-cookiefile"),
@@ -198,12 +352,18 @@ struct Main {
 
         cdn = std::make_unique<RCDN>(cli.cdn, cache.get());
 
+        mem_cache = std::make_unique<ChunkCache>(cli.mem_cache);
+
+        if (cli.mem_cache && cli.readahead) {
+            prefetch = std::make_unique<Prefetch>(cdn.get(), mem_cache.get());
+        }
+
         std::cerr << "Parsing input manifests ... " << std::endl;
         auto builder = root->builder();
-        for (auto const &p : paths) {
+        RFile::read_files(paths, [&, this](fs::path const &p, std::vector<RFile> &files) {
             auto const name = p.filename().replace_extension("").generic_string() + '/';
             auto const time_sec = fs_get_time(p);
-            RFile::read_file(p, [&, this](RFile &rfile) {
+            for (auto &rfile : files) {
                 if (this->cli.with_prefix) {
                     rfile.path.insert(rfile.path.begin(), name.begin(), name.end());
                 }
@@ -213,9 +373,8 @@ struct Main {
                     }
                     builder(rfile);
                 }
-                return true;
-            });
-        }
+            }
+        });
         builder = nullptr;
 
         std::cerr << "Mounted!" << std::endl;
@@ -257,13 +416,44 @@ static auto get_stats(RDirEntry const *entry, struct stat *stbuf) -> void {
     stbuf->st_mtim.tv_sec = stbuf->st_ctim.tv_sec = time_sec;
 }
 
+// State of opened file or directory, kept in fuse_file_info::fh.
+struct Handle {
+    RDirEntry const *entry;
+    std::atomic<std::uint64_t> next_offset = {};
+    std::atomic<std::uint64_t> prefetch_offset = {};
+};
+
+static auto get_handle(struct fuse_file_info const *fi) -> Handle * {
+    return fi ? (Handle *)(void *)(std::uintptr_t)fi->fh : nullptr;
+}
+
 static auto get_entry(const char *cpath, struct fuse_file_info const *fi) -> RDirEntry const * {
-    if (fi && fi->fh) {
-        return (RDirEntry const *)(void const *)(std::uintptr_t)fi->fh;
+    if (auto const handle = get_handle(fi)) {
+        return handle->entry;
     }
     return cpath ? main_.root->find(cpath + 1) : nullptr;
 }
 
+// Keeps up to readahead chunks queued after offset, refills once half of them were consumed.
+static auto prefetch_chunks(Handle *handle, std::span<RChunk::Dst const> chunks, std::size_t offset) -> void {
+    auto const real_size = handle->entry->size();
+    if (offset >= real_size) {
+        return;
+    }
+    auto ahead = find_chunks_in_range(chunks, offset, real_size - offset);
+    ahead = ahead.subspan(0, std::min(ahead.size(), (std::size_t)main_.cli.readahead));
+    auto const queued_end = handle->prefetch_offset.load();
+    auto const queued = std::partition_point(ahead.begin(), ahead.end(), [queued_end](RChunk::Dst const &chunk) {
+        return chunk.uncompressed_offset < queued_end;
+    });
+    if (ahead.empty() || (std::size_t)(queued - ahead.begin()) * 2 > ahead.size()) {
+        return;
+    }
+    auto fresh = std::span(queued, ahead.end());
+    handle->prefetch_offset = fresh.back().uncompressed_offset + fresh.back().uncompressed_size;
+    main_.prefetch->push(fresh);
+}
+
 static void *impl_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
     (void)conn;
     cfg->kernel_cache = 1;
@@ -287,7 +477,7 @@ static int impl_opendir(const char *cpath, struct fuse_file_info *fi) {
     if (!entry->is_dir()) {
         return -ENOTDIR;
     }
-    fi->fh = (std::uintptr_t)(void const *)entry;
+    fi->fh = (std::uintptr_t)(void *)new Handle{.entry = entry};
     return 0;
 }
 
@@ -329,7 +519,11 @@ static int impl_readdir(const char *cpath,
     return 0;
 }
 
-static int impl_releasedir(const char *, struct fuse_file_info *) { return 0; }
+static int impl_releasedir(const char *, struct fuse_file_info *fi) {
+    delete get_handle(fi);
+    fi->fh = 0;
+    return 0;
+}
 
 static int impl_fsyncdir(const char *, int, struct fuse_file_info *) { return 0; }
 
@@ -345,7 +539,7 @@ static int impl_open(const char *cpath, struct fuse_file_info *fi) {
         return -EROFS;
     }
     fi->keep_cache = 1;
-    fi->fh = (std::uintptr_t)(void const *)entry;
+    fi->fh = (std::uintptr_t)(void *)new Handle{.entry = entry};
     entry->open();
     return 0;
 }
@@ -368,15 +562,19 @@ static int impl_read(const char *cpath, char *buf, size_t size, off_t offset, st
     if (size == 0) {
         return 0;
     }
-    thread_local struct Last {
-        ChunkID id = {};
-        Buffer buffer = {};
-    } last = {};
     auto done = std::size_t{};
     try {
         rlib_trace("offset: 0x%llx, size: 0x%llx, done: %llx", offset, size, done);
         auto chunks = entry->chunks([](FileID fileId) { return main_.cache->get_chunks(fileId); });
         rlib_assert(chunks && !chunks->empty());
+        if (auto const handle = get_handle(fi)) {
+            auto const sequential = handle->next_offset.exchange(offset + size) == offset;
+            if (!sequential) {
+                handle->prefetch_offset = 0;
+            } else if (main_.prefetch) {
+                prefetch_chunks(handle, *chunks, offset + size);
+            }
+        }
         for (RChunk::Dst const &chunk : find_chunks_in_range(*chunks, offset, size)) {
             rlib_trace("chunkId: %016llX, offset: 0x%llx, size: 0x%0llx",
                        chunk.chunkId,
@@ -385,19 +583,24 @@ static int impl_read(const char *cpath, char *buf, size_t size, off_t offset, st
             if (fuse_interrupted()) {
                 return -EINTR;
             }
-            if (chunk.uncompressed_offset == offset + done && size - done >= chunk.uncompressed_size) {
+            if (main_.prefetch && !main_.prefetch->wait(chunk.chunkId)) {
+                return -EINTR;
+            }
+            auto data = main_.mem_cache->get(chunk.chunkId);
+            if (!data && chunk.uncompressed_offset == offset + done && size - done >= chunk.uncompressed_size) {
+                // whole chunk is requested, kernel page cache keeps it so skip the extra copy
                 rlib_assert(main_.cdn->get_into(chunk, {buf + done, chunk.uncompressed_size}));
                 done += chunk.uncompressed_size;
                 continue;
             }
-            if (last.id != chunk.chunkId) {
-                fflush(stdout);
-                last.id = ChunkID::None;
-                rlib_assert(last.buffer.resize_destroy(chunk.uncompressed_size));
-                rlib_assert(main_.cdn->get_into(chunk, last.buffer));
-                last.id = chunk.chunkId;
+            if (!data) {
+                auto buffer = std::make_shared<Buffer>();
+                rlib_assert(buffer->resize_destroy(chunk.uncompressed_size));
+                rlib_assert(main_.cdn->get_into(chunk, *buffer));
+                main_.mem_cache->put(chunk.chunkId, buffer);
+                data = std::move(buffer);
             }
-            auto src = std::span<char const>(last.buffer);
+            auto src = std::span<char const>(*data);
             if (auto const pos = (offset + done); pos > chunk.uncompressed_offset) {
                 src = src.subspan(pos - chunk.uncompressed_offset);
             }
@@ -427,6 +630,8 @@ static int impl_release(const char *cpath, struct fuse_file_info *fi) {
         return -ENOENT;
     }
     entry->close();
+    delete get_handle(fi);
+    fi->fh = 0;
     return 0;
 }
 
@@ -462,5 +667,11 @@ int main(int argc, char *argv[]) {
         error_stack().clear();
         return EXIT_FAILURE;
     }
-    return fuse_main(main_.fargs.argc, main_.fargs.argv, &impl_oper, NULL);
+    auto result = fuse_main(main_.fargs.argc, main_.fargs.argv, &impl_oper, NULL);
+    main_.prefetch = nullptr;
+    if (main_.mem_cache && main_.mem_cache->max_size()) {
+        std::cerr << "Memory cache hits: " << main_.mem_cache->hits() << ", misses: " << main_.mem_cache->misses()
+                  << std::endl;
+    }
+    return result;
 }
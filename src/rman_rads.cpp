@@ -189,7 +189,7 @@ struct Main {
                             lookup,
                             provider,
                             [&](RFile&& rfile) {
-                                rfile.langs = rls.langs;
+                                rfile.langs = Langs::parse(rls.langs);
                                 cb(std::move(rfile));
                             });
             }
@@ -3,12 +3,15 @@
 #include <fmt/format.h>
 
 #include <argparse.hpp>
+#include <deque>
+#include <future>
 #include <iostream>
 #include <rlib/ar.hpp>
 #include <rlib/common.hpp>
 #include <rlib/iofile.hpp>
 #include <rlib/rcache.hpp>
 #include <rlib/rmanifest.hpp>
+#include <rlib/threadpool.hpp>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -122,6 +125,8 @@ struct Main {
         std::size_t chunk_size = 0;
         std::int32_t level = 0;
         std::int32_t level_high_entropy = 0;
+        std::size_t dict_size = 0;
+        std::uint32_t threads = 1;
         Ar ar = {};
     } cli = {};
     std::unique_ptr<RCache> inbundle;
@@ -139,22 +144,22 @@ struct Main {
 
         program.add_argument("-l", "--filter-lang")
             .help("Filter: language(none for international files).")
-            .default_value(std::optional<std::regex>{})
-            .action([](std::string const& value) -> std::optional<std::regex> {
+            .default_value(std::optional<Pattern>{})
+            .action([](std::string const& value) -> std::optional<Pattern> {
                 if (value.empty()) {
                     return std::nullopt;
                 } else {
-                    return std::regex{value, std::regex::optimize | std::regex::icase};
+                    return Pattern{value};
                 }
             });
         program.add_argument("-p", "--filter-path")
             .help("Filter: path with regex match.")
-            .default_value(std::optional<std::regex>{})
-            .action([](std::string const& value) -> std::optional<std::regex> {
+            .default_value(std::optional<Pattern>{})
+            .action([](std::string const& value) -> std::optional<Pattern> {
                 if (value.empty()) {
                     return std::nullopt;
                 } else {
-                    return std::regex{value, std::regex::optimize | std::regex::icase};
+                    return Pattern{value};
                 }
             });
 
@@ -214,6 +219,12 @@ struct Main {
             .action([](std::string const& value) -> std::int32_t {
                 return std::clamp((std::int32_t)std::stol(value), -7, 22);
             });
+        program.add_argument("--dict-size")
+            .help("Size of zstd dictionary trained from sampled chunks in kilobytes(0 to disable) [0, 1024]")
+            .default_value(std::uint32_t{0})
+            .action([](std::string const& value) -> std::uint32_t {
+                return std::clamp((std::uint32_t)std::stoul(value), 0u, 1024u);
+            });
 
         program.add_argument("--newonly")
             .help("Force create new part regardless of size.")
@@ -231,6 +242,12 @@ struct Main {
             .action([](std::string const& value) -> std::uint32_t {
                 return std::clamp((std::uint32_t)std::stoul(value), 0u, 4096u);
             });
+        program.add_argument("--threads")
+            .help("Number of threads used to hash and compress chunks(0 for all cores) [0, 256]")
+            .default_value(std::uint32_t{1})
+            .action([](std::string const& value) -> std::uint32_t {
+                return std::clamp((std::uint32_t)std::stoul(value), 0u, 256u);
+            });
 
         program.parse_args(argc, argv);
 
@@ -245,8 +262,8 @@ struct Main {
         cli.inbundle = {.path = program.get<std::string>("inbundle"), .readonly = true};
         cli.inmanifests = program.get<std::vector<std::string>>("inmanifests");
 
-        cli.match.langs = program.get<std::optional<std::regex>>("--filter-lang");
-        cli.match.path = program.get<std::optional<std::regex>>("--filter-path");
+        cli.match.langs = program.get<std::optional<Pattern>>("--filter-lang");
+        cli.match.path = program.get<std::optional<Pattern>>("--filter-path");
 
         cli.resume_file = program.get<std::string>("--resume");
         cli.resume_buffer = program.get<std::uint32_t>("--resume-buffer") * KiB;
@@ -256,6 +273,11 @@ struct Main {
         cli.with_prefix = program.get<bool>("--with-prefix");
         cli.level = program.get<std::int32_t>("--level");
         cli.level_high_entropy = program.get<std::int32_t>("--level-high-entropy");
+        cli.dict_size = program.get<std::uint32_t>("--dict-size") * KiB;
+        cli.threads = program.get<std::uint32_t>("--threads");
+        if (!cli.threads) {
+            cli.threads = ThreadPool::hardware_threads();
+        }
 
         cli.ar = Ar{
             .chunk_min = program.get<std::uint32_t>("--ar-min") * KiB,
@@ -276,6 +298,13 @@ struct Main {
         std::cerr << "Processing output bundle ... " << std::endl;
         auto outbundle = RCache(cli.outbundle);
 
+        if (cli.dict_size) {
+            std::cerr << "Training dictionary ... " << std::endl;
+            train_dict(manifests, outbundle);
+        }
+
+        auto pool = ThreadPool(cli.threads);
+
         std::cerr << "Processing resume file" << std::endl;
         auto resume_file = ResumeFile(cli.resume_file, cli.resume_buffer);
 
@@ -283,24 +312,71 @@ struct Main {
         auto writer = RFile::writer(cli.outmanifest, cli.append);
 
         std::cerr << "Processing input manifests ... " << std::endl;
-        for (std::uint32_t index = manifests.size(); auto const& path : manifests) {
+        auto index = (std::uint32_t)manifests.size();
+        RFile::read_files(manifests, [&, this](fs::path const& path, std::vector<RFile>& files) {
             auto const name = path.filename().replace_extension("").generic_string() + '/';
             std::cerr << "MANIFEST: " << path << std::endl;
-            RFile::read_file(path, [&, this](RFile& ofile) {
+            for (auto& ofile : files) {
                 if (this->cli.with_prefix) {
                     ofile.path.insert(ofile.path.begin(), name.begin(), name.end());
                 }
                 if (cli.match(ofile)) {
-                    auto nfile = add_file(ofile, outbundle, resume_file, index);
+                    auto nfile = add_file(ofile, outbundle, pool, resume_file, index);
                     writer(std::move(nfile));
                 }
-                return true;
-            });
+            }
             --index;
+        });
+    }
+
+    auto train_dict(std::vector<fs::path> const& manifests, RCache& outbundle) -> void {
+        auto samples = RCache::DictSamples{.dict_size = cli.dict_size};
+        // chunking is deterministic so samples are the same chunks that get compressed afterwards
+        auto const ar = cli.ar;
+        auto buffer = Buffer{};
+        for (auto const& path : manifests) {
+            auto const name = path.filename().replace_extension("").generic_string() + '/';
+            RFile::read_file(path, [&, this](RFile& ofile) {
+                if (this->cli.with_prefix) {
+                    ofile.path.insert(ofile.path.begin(), name.begin(), name.end());
+                }
+                if (cli.match(ofile) && ofile.link.empty()) {
+                    read_file(ofile, buffer, 0, true);
+                    ar(buffer, [&](Ar::Entry const& entry) { samples.add(buffer.copy(entry.offset, entry.size)); });
+                }
+                return !samples.full();
+            });
+            if (samples.full()) {
+                break;
+            }
         }
+        auto const dict = samples.train();
+        if (dict.empty()) {
+            std::cerr << "Not enough samples to train dictionary, compressing without one." << std::endl;
+            return;
+        }
+        auto const dict_id = outbundle.set_dict(dict);
+        std::cerr << fmt::format("DICT: {:08X} from {} samples", dict_id, samples.sizes.size()) << std::endl;
     }
 
-    auto add_file(RFile& rfile, RCache& outbundle, ResumeFile& resume_file, std::uint32_t index) -> RFile {
+    auto read_file(RFile& rfile, Buffer& buffer, std::uint32_t index, bool no_progress) -> void {
+        rlib_assert(buffer.resize_destroy(rfile.size));
+        auto p = progress_bar("READ", no_progress, index, 0, buffer.size());
+        if (!rfile.chunks) {
+            if (rfile.size) {
+                rfile.chunks = inbundle->get_chunks(rfile.fileId);
+                rlib_assert(!rfile.chunks->empty());
+            }
+        }
+        auto const bad_chunks = inbundle->get(*rfile.chunks, [&](RChunk::Dst const& chunk, std::span<char const> data) {
+            p.update(chunk.uncompressed_offset + data.size());
+            rlib_assert(buffer.write(chunk.uncompressed_offset, data));
+        });
+        rlib_assert(bad_chunks.empty());
+    }
+
+    auto add_file(RFile& rfile, RCache& outbundle, ThreadPool& pool, ResumeFile& resume_file, std::uint32_t index)
+        -> RFile {
         auto const path = rfile.path;
         auto const fileId = rfile.fileId;
         rlib_trace("path: %s, fid: %016llx\n", path.c_str(), (unsigned long long)fileId);
@@ -309,34 +385,35 @@ struct Main {
             return std::move(rfile);
         }
         thread_local Buffer buffer = {};
-        {
-            rlib_assert(buffer.resize_destroy(rfile.size));
-            auto p = progress_bar("READ", cli.no_progress, index, 0, buffer.size());
-            if (!rfile.chunks) {
-                if (rfile.size) {
-                    rfile.chunks = inbundle->get_chunks(rfile.fileId);
-                    rlib_assert(!rfile.chunks->empty());
-                }
-            }
-            auto const bad_chunks =
-                inbundle->get(*rfile.chunks, [&](RChunk::Dst const& chunk, std::span<char const> data) {
-                    p.update(chunk.uncompressed_offset + data.size());
-                    rlib_assert(buffer.write(chunk.uncompressed_offset, data));
-                });
-            rlib_assert(bad_chunks.empty());
-        }
+        read_file(rfile, buffer, index, cli.no_progress);
         {
             rfile.chunks = std::vector<RChunk::Dst>{};
             auto p = progress_bar("PROCESSED", cli.no_progress, index, 0, buffer.size());
-            cli.ar(buffer, [&](Ar::Entry const& entry) {
-                auto src = buffer.copy(entry.offset, entry.size);
-                auto level = cli.level_high_entropy && entry.high_entropy ? cli.level_high_entropy : cli.level;
-                RChunk::Dst chunk = {outbundle.add_uncompressed(src, level)};
+            // Compress on pool but append in order so output does not depend on thread count.
+            auto pending = std::deque<std::pair<Ar::Entry, std::future<RCache::Compressed>>>{};
+            auto const max_pending = std::max(pool.size(), 1u) * 8;
+            auto commit = [&] {
+                auto [entry, result] = std::move(pending.front());
+                pending.pop_front();
+                RChunk::Dst chunk = {outbundle.add_compressed(result.get())};
                 chunk.hash_type = HashType::RITO_HKDF;
-                rfile.chunks->push_back(chunk);
                 chunk.uncompressed_offset = entry.offset;
+                rfile.chunks->push_back(chunk);
                 p.update(entry.offset + entry.size);
+            };
+            cli.ar(buffer, [&](Ar::Entry const& entry) {
+                auto src = buffer.copy(entry.offset, entry.size);
+                auto level = cli.level_high_entropy && entry.high_entropy ? cli.level_high_entropy : cli.level;
+                pending.emplace_back(entry, pool.submit([src, level, &outbundle] {
+                    return outbundle.compress(src, level);
+                }));
+                while (pending.size() > max_pending) {
+                    commit();
+                }
             });
+            while (!pending.empty()) {
+                commit();
+            }
         }
         if (!cli.ar.errors.empty()) {
             std::cout << "Smart chunking failed for:\n";